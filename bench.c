@@ -0,0 +1,389 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "rwlock.h"
+#include "bench_common.h"
+#include "qrwlock.h"
+#include "crwlock.h"
+#include "prwlock.h"
+
+/* bench hammers one rwl from a number of threads and reports throughput.
+ *
+ *   ./bench [-t threads] [-r read%] [-c cs_loops] [-d seconds] [-n locks]
+ *           [-w mix] [-b] [-a] [-f] [-o] [-m] [-s] [-q] [-k batch]
+ *           [-N nodes] [-p] [-P] [-h]
+ *
+ * Each operation is a read (with probability read%) or a write at a random
+ * priority, holding the lock for cs_loops iterations of an empty loop.  The
+ * priorities are equally likely unless -w gives their weights, highest
+ * priority first, as in -w 1:8:1.  -b uses an RWL_BIGREADER lock, -a an
+ * RWL_ADAPTIVE one and -f an RWL_PHASE_FAIR one.  -n spreads the threads over an array of that many
+ * adjacent locks, thread i using lock i % locks; with as many locks as
+ * threads nothing is shared but cache lines, which is what bench_compact
+ * (built with -DRWL_COMPACT) is for.
+ * -o does the reads optimistically with rwl_oread_begin/rwl_oread_retry.
+ * -m does the writes with rwl_combine, the critical section being the op.
+ * -s makes the rwl locks RWL_STATS ones and prints what they counted, summed
+ * over the locks, to stderr.
+ * -q runs the same load on qrwl, the queue-based lock, instead.
+ * -k runs it on crwl, the NUMA cohort lock, handing the lock on within a
+ * node up to batch times (-k 0 never does).  -N makes crwl pretend there
+ * are that many nodes, thread i binding itself to node i % nodes, and -p
+ * pins thread i to a CPU, going round the NUMA nodes so that neighbouring
+ * threads sit on different ones.
+ * -P runs it on prwl, the process-shared lock, from threads of this one
+ * process: what its shared futexes and robust mutex cost.
+ * The output is one CSV line:
+ *
+ *   threads,read_pct,cs_loops,ops_per_sec,vcsw_per_kop
+ *
+ * where vcsw_per_kop is voluntary context switches per thousand operations,
+ * i.e. how often a thread had to sleep in the lock.
+ */
+
+static rwl *locks;
+static qrwl *qlocks;
+static crwl *cohorts;
+static prwl *plocks;
+static int nlocks = 1;
+static volatile int stop;
+static int read_pct = 90;
+static int optimistic;
+static int combining;
+static int queued;
+static int shared;
+static int batch = -1;
+static int fake_nodes;
+static int pinned;
+static int *pin;
+
+typedef struct {
+	unsigned int seed;
+	rwl *lock;
+	qrwl *qlock;
+	crwl *cohort;
+	prwl *plock;
+	int id;
+	long ops;
+} worker_t;
+
+static void
+combined_section(void *arg)
+{
+	critical_section();
+}
+
+static void *
+worker(void *arg)
+{
+	worker_t *w = arg;
+	rwl *lock = w->lock;
+	qrwl *qlock = w->qlock;
+	crwl *cohort = w->cohort;
+	prwl *plock = w->plock;
+
+	if (pin != NULL) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(pin[w->id], &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+	if (fake_nodes > 0) {
+		crwl_bind(w->id % fake_nodes);
+	}
+	while (!stop) {
+		int read = (int)(rand_r(&w->seed) % 100) < read_pct;
+
+		if (cohort != NULL && read) {
+			crwl_rlock(cohort);
+			critical_section();
+			crwl_runlock(cohort);
+		} else if (cohort != NULL) {
+			int priority = pick_priority(&w->seed);
+			crwl_wlock(cohort, priority);
+			critical_section();
+			crwl_wunlock(cohort, priority);
+		} else if (plock != NULL && read) {
+			prwl_rlock(plock);
+			critical_section();
+			prwl_runlock(plock);
+		} else if (plock != NULL) {
+			int priority = pick_priority(&w->seed);
+			prwl_wlock(plock, priority);
+			critical_section();
+			prwl_wunlock(plock, priority);
+		} else if (qlock != NULL && read) {
+			qrwl_rlock(qlock);
+			critical_section();
+			qrwl_runlock(qlock);
+		} else if (qlock != NULL) {
+			int priority = pick_priority(&w->seed);
+			qrwl_wlock(qlock, priority);
+			critical_section();
+			qrwl_wunlock(qlock, priority);
+		} else if (read && optimistic) {
+			unsigned int stamp = 0;
+			do {
+				rwl_oread_begin(lock, &stamp);
+				critical_section();
+			} while (rwl_oread_retry(lock, &stamp));
+		} else if (read) {
+			rwl_rlock(lock);
+			critical_section();
+			rwl_runlock(lock);
+		} else if (combining) {
+			rwl_combine(lock, pick_priority(&w->seed),
+			    &combined_section, NULL);
+		} else {
+			int priority = pick_priority(&w->seed);
+			rwl_wlock(lock, priority);
+			critical_section();
+			rwl_wunlock(lock, priority);
+		}
+		w->ops++;
+	}
+	return NULL;
+}
+
+// print_stat prints one line of print_stats
+static void
+print_stat(const char *who, rwl_stat *st)
+{
+	fprintf(stderr, "%-8s %10llu %10llu %10.1f %10.1f %10.1f %10.1f %8llu\n",
+	    who, st->acquired, st->contended,
+	    st->contended ? st->wait_ns / 1e3 / st->contended : 0.0,
+	    st->wait_max_ns / 1e3,
+	    st->acquired ? st->hold_ns / 1e3 / st->acquired : 0.0,
+	    st->hold_max_ns / 1e3, st->spurious);
+}
+
+// print_stats prints the counters of all locks together, times in us
+static void
+print_stats(int n)
+{
+	rwl_stats sum, st;
+	char who[16];
+
+	memset(&sum, 0, sizeof(sum));
+	for (int i = 0; i < n; i++) {
+		rwl_stats_get(&locks[i], &st);
+		for (int p = -1; p < RWL_LEVELS; p++) {
+			rwl_stat *from = p < 0 ? &st.read : &st.write[p];
+			rwl_stat *to = p < 0 ? &sum.read : &sum.write[p];
+			to->acquired += from->acquired;
+			to->contended += from->contended;
+			to->wait_ns += from->wait_ns;
+			to->hold_ns += from->hold_ns;
+			to->spurious += from->spurious;
+			if (from->wait_max_ns > to->wait_max_ns) {
+				to->wait_max_ns = from->wait_max_ns;
+			}
+			if (from->hold_max_ns > to->hold_max_ns) {
+				to->hold_max_ns = from->hold_max_ns;
+			}
+		}
+	}
+	fprintf(stderr, "%-8s %10s %10s %10s %10s %10s %10s %8s\n", "", "acquired",
+	    "contended", "wait_avg", "wait_max", "hold_avg", "hold_max",
+	    "spurious");
+	print_stat("read", &sum.read);
+	for (int p = 0; p < RWL_LEVELS; p++) {
+		snprintf(who, sizeof(who), "write%d", p);
+		print_stat(who, &sum.write[p]);
+	}
+}
+
+/**
+ * pin_order lists the online CPUs one per NUMA node in turn, so that
+ * consecutive threads land on different nodes
+ * @param nthreads - how many entries to fill in
+ * @return int * - CPU for each thread, or NULL
+ * **/
+static int *
+pin_order(int nthreads)
+{
+	int ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int *cpu = calloc(ncpu, sizeof(int));
+	int *order = calloc(nthreads, sizeof(int));
+	int nnodes = 1, n = 0;
+
+	if (ncpu < 1 || cpu == NULL || order == NULL) {
+		free(cpu);
+		free(order);
+		return NULL;
+	}
+	for (int c = 0; c < ncpu; c++) {
+		if (crwl_cpu_node(c) >= nnodes) {
+			nnodes = crwl_cpu_node(c) + 1;
+		}
+	}
+	// round r takes the r-th CPU of every node
+	for (int r = 0; n < ncpu; r++) {
+		for (int node = 0; node < nnodes; node++) {
+			for (int c = 0, seen = 0; c < ncpu; c++) {
+				if (crwl_cpu_node(c) == node && seen++ == r) {
+					cpu[n++] = c;
+					break;
+				}
+			}
+		}
+	}
+	for (int i = 0; i < nthreads; i++) {
+		order[i] = cpu[i % ncpu];
+	}
+	free(cpu);
+	return order;
+}
+
+static void
+usage(FILE *fp, const char *prog)
+{
+	fprintf(fp, "usage: %s [-t threads] [-r read%%] [-c cs_loops] "
+	    "[-d seconds] [-n locks] [-w mix] [-b] [-a] [-f] [-o] [-m] [-s] "
+	    "[-q] [-k batch] [-N nodes] [-p] [-P] [-h]\n", prog);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int nthreads = 4;
+	int seconds = 2;
+	rwl_attr attr;
+	int opt;
+
+	rwl_attr_init(&attr);
+	mix_uniform();
+	while ((opt = getopt(argc, argv, "t:r:c:d:n:w:bafomsqk:N:pPh")) != -1) {
+		switch (opt) {
+		case 't': nthreads = atoi(optarg); break;
+		case 'r': read_pct = atoi(optarg); break;
+		case 'c': cs_loops = atoi(optarg); break;
+		case 'd': seconds = atoi(optarg); break;
+		case 'n': nlocks = atoi(optarg); break;
+		case 'w':
+			if (parse_mix(optarg) != 0) {
+				fprintf(stderr, "bad priority mix %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'b': attr.flags |= RWL_BIGREADER; break;
+		case 'a': attr.flags |= RWL_ADAPTIVE; break;
+		case 'f': attr.flags |= RWL_PHASE_FAIR; break;
+		case 'o': optimistic = 1; break;
+		case 'm': combining = 1; break;
+		case 's': attr.flags |= RWL_STATS; break;
+		case 'q': queued = 1; break;
+		case 'k': batch = atoi(optarg); break;
+		case 'N': fake_nodes = atoi(optarg); break;
+		case 'p': pinned = 1; break;
+		case 'P': shared = 1; break;
+		case 'h':
+			usage(stdout, argv[0]);
+			return 0;
+		default:
+			usage(stderr, argv[0]);
+			return 1;
+		}
+	}
+	if (nlocks < 1) {
+		nlocks = 1;
+	}
+	locks = aligned_alloc(RWL_CACHELINE, nlocks * sizeof(*locks));
+	for (int i = 0; i < nlocks; i++) {
+		if (locks == NULL || rwl_init_attr(&locks[i], &attr) != 0) {
+			fprintf(stderr, "rwl_init_attr failed\n");
+			return 1;
+		}
+	}
+	if (queued) {
+		qlocks = aligned_alloc(RWL_CACHELINE, nlocks * sizeof(*qlocks));
+		if (qlocks == NULL) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+		for (int i = 0; i < nlocks; i++) {
+			qrwl_init(&qlocks[i]);
+		}
+	}
+	if (batch >= 0) {
+		cohorts = aligned_alloc(RWL_CACHELINE, nlocks * sizeof(*cohorts));
+		for (int i = 0; i < nlocks; i++) {
+			if (cohorts == NULL ||
+			    crwl_init(&cohorts[i], fake_nodes, batch) != 0) {
+				fprintf(stderr, "crwl_init failed\n");
+				return 1;
+			}
+		}
+	}
+	if (shared) {
+		plocks = aligned_alloc(RWL_CACHELINE, nlocks * sizeof(*plocks));
+		for (int i = 0; i < nlocks; i++) {
+			if (plocks == NULL || prwl_init(&plocks[i]) != 0) {
+				fprintf(stderr, "prwl_init failed\n");
+				return 1;
+			}
+		}
+	}
+	if (pinned && (pin = pin_order(nthreads)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	pthread_t *th = calloc(nthreads, sizeof(*th));
+	worker_t *w = calloc(nthreads, sizeof(*w));
+	struct rusage before, after;
+
+	getrusage(RUSAGE_SELF, &before);
+	for (int i = 0; i < nthreads; i++) {
+		w[i].seed = i + 1;
+		w[i].lock = &locks[i % nlocks];
+		w[i].qlock = queued ? &qlocks[i % nlocks] : NULL;
+		w[i].cohort = batch >= 0 ? &cohorts[i % nlocks] : NULL;
+		w[i].plock = shared ? &plocks[i % nlocks] : NULL;
+		w[i].id = i;
+		pthread_create(&th[i], NULL, worker, &w[i]);
+	}
+	sleep(seconds);
+	stop = 1;
+
+	long ops = 0;
+	for (int i = 0; i < nthreads; i++) {
+		pthread_join(th[i], NULL);
+		ops += w[i].ops;
+	}
+	getrusage(RUSAGE_SELF, &after);
+
+	long vcsw = after.ru_nvcsw - before.ru_nvcsw;
+	printf("%d,%d,%d,%.0f,%.3f\n", nthreads, read_pct, cs_loops,
+	    (double)ops / seconds, ops ? 1000.0 * vcsw / ops : 0.0);
+
+	if (attr.flags & RWL_STATS) {
+		print_stats(nlocks);
+	}
+	for (int i = 0; i < nlocks; i++) {
+		rwl_destroy(&locks[i]);
+		if (queued) {
+			qrwl_destroy(&qlocks[i]);
+		}
+		if (batch >= 0) {
+			crwl_destroy(&cohorts[i]);
+		}
+		if (shared) {
+			prwl_destroy(&plocks[i]);
+		}
+	}
+	free(locks);
+	free(qlocks);
+	free(cohorts);
+	free(plocks);
+	free(pin);
+	free(th);
+	free(w);
+	return 0;
+}
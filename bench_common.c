@@ -0,0 +1,65 @@
+#include <stdlib.h>
+
+#include "bench_common.h"
+
+int cs_loops = 100;
+int mix[RWL_LEVELS];
+int mix_total;
+
+// mix_uniform makes every priority equally likely, the default
+void
+mix_uniform(void)
+{
+	for (int p = 0; p < RWL_LEVELS; p++) {
+		mix[p] = 1;
+	}
+	mix_total = RWL_LEVELS;
+}
+
+/**
+ * parse_mix reads the -w argument, weights separated by colons
+ * @param arg - the argument
+ * @return int - 0, or -1 if it makes no sense
+ * **/
+int
+parse_mix(char *arg)
+{
+	char *end;
+
+	mix_total = 0;
+	for (int p = 0; p < RWL_LEVELS; p++) {
+		mix[p] = 0;
+	}
+	for (int p = 0; *arg != '\0'; p++) {
+		if (p == RWL_LEVELS) {
+			return -1;
+		}
+		mix[p] = (int)strtol(arg, &end, 10);
+		if (end == arg || mix[p] < 0 || (*end != ':' && *end != '\0')) {
+			return -1;
+		}
+		mix_total += mix[p];
+		arg = *end == ':' ? end + 1 : end;
+	}
+	return mix_total > 0 ? 0 : -1;
+}
+
+// pick_priority draws a writer priority according to the -w weights
+int
+pick_priority(unsigned int *seed)
+{
+	int r = rand_r(seed) % mix_total;
+	int p = 0;
+
+	while (r >= mix[p]) {
+		r -= mix[p++];
+	}
+	return p;
+}
+
+void
+critical_section(void)
+{
+	for (volatile int i = 0; i < cs_loops; i++) {
+	}
+}
@@ -0,0 +1,20 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include "rwlock.h"
+
+/* The load bench and bench_latency share: operations hold the lock for
+ * cs_loops iterations of an empty loop, and writers pick their priority
+ * with the weights in mix, highest priority first, as -w sets them.
+ */
+
+extern int cs_loops;
+extern int mix[RWL_LEVELS];
+extern int mix_total;
+
+void mix_uniform(void);
+int parse_mix(char *arg);
+int pick_priority(unsigned int *seed);
+void critical_section(void);
+
+#endif
@@ -0,0 +1,305 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <math.h>
+
+#include "rwlock.h"
+#include "bench_common.h"
+
+/* bench_latency measures how long each acquisition of one rwl takes, from
+ * request to lock held, separately for readers and for writers of each
+ * priority.
+ *
+ *   ./bench_latency [-t threads] [-r read%] [-c cs_loops] [-d seconds]
+ *                   [-w mix] [-R rate] [-b] [-a] [-f] [-p] [-h]
+ *
+ * The load is the one bench generates: reads with probability read%,
+ * writes at a priority drawn with the -w weights (uniform by default), each
+ * holding the lock for cs_loops iterations of an empty loop.  -b, -a and -f
+ * pick an RWL_BIGREADER, RWL_ADAPTIVE or RWL_PHASE_FAIR lock, and -p pins
+ * thread i to CPU i.
+ *
+ * Without -R every thread issues its next request as soon as the last one
+ * is done (closed loop).  That understates the tail: a thread stuck behind
+ * the lock issues no requests meanwhile, so the slow period is sampled once.
+ * With -R each thread issues rate requests per second at exponentially
+ * distributed intervals (open loop), and an operation's latency runs from
+ * when it was due, not from when the thread got round to it.
+ *
+ * Latencies go into log-bucketed histograms, HDR style: 2^SUB_BITS linear
+ * buckets per power of two, so every value is recorded to within about 3%.
+ * The output is a CSV table, times in nanoseconds:
+ *
+ *   who,ops,p50_ns,p99_ns,p999_ns,max_ns
+ */
+
+#define SUB_BITS            5
+#define SUB_COUNT           (1 << SUB_BITS)
+#define BUCKETS             ((64 - SUB_BITS + 1) * SUB_COUNT)
+#define CLASSES             (RWL_LEVELS + 1) // readers, writers by priority
+
+typedef struct {
+	unsigned long long  count[BUCKETS];
+	unsigned long long  total;
+	unsigned long long  max;
+} hist_t;
+
+typedef struct {
+	unsigned int        seed;
+	int                 id;
+	hist_t             *hist;       // CLASSES of them
+} worker_t;
+
+static rwl lock;
+static volatile int stop;
+static int read_pct = 90;
+static double rate;
+static int pinned;
+
+static inline unsigned long long
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// bucket_of maps a value to its histogram bucket
+static inline int
+bucket_of(unsigned long long v)
+{
+	int e;
+
+	if (v < SUB_COUNT) {
+		return (int)v;
+	}
+	e = 63 - __builtin_clzll(v);
+	return (e - SUB_BITS + 1) * SUB_COUNT +
+	    (int)((v >> (e - SUB_BITS)) - SUB_COUNT);
+}
+
+// bucket_top is the largest value that lands in bucket b
+static unsigned long long
+bucket_top(int b)
+{
+	int e = b / SUB_COUNT + SUB_BITS - 1;
+	unsigned long long sub = b % SUB_COUNT + SUB_COUNT;
+
+	if (b < SUB_COUNT) {
+		return b;
+	}
+	return ((sub + 1) << (e - SUB_BITS)) - 1;
+}
+
+static void
+hist_record(hist_t *h, unsigned long long v)
+{
+	h->count[bucket_of(v)]++;
+	h->total++;
+	if (v > h->max) {
+		h->max = v;
+	}
+}
+
+static void
+hist_merge(hist_t *to, const hist_t *from)
+{
+	for (int b = 0; b < BUCKETS; b++) {
+		to->count[b] += from->count[b];
+	}
+	to->total += from->total;
+	if (from->max > to->max) {
+		to->max = from->max;
+	}
+}
+
+/**
+ * @param h - histogram
+ * @param q - quantile, between 0 and 1
+ * @return unsigned long long - the value below which a fraction q of the
+ * recorded values lie, rounded up to its bucket's top and capped at the max
+ * **/
+static unsigned long long
+hist_quantile(const hist_t *h, double q)
+{
+	unsigned long long want = (unsigned long long)(q * h->total + 0.5);
+	unsigned long long seen = 0;
+
+	if (want == 0) {
+		want = 1;
+	}
+	for (int b = 0; b < BUCKETS; b++) {
+		seen += h->count[b];
+		if (seen >= want) {
+			return bucket_top(b) < h->max ? bucket_top(b) : h->max;
+		}
+	}
+	return h->max;
+}
+
+/**
+ * @param seed - random state of the calling thread
+ * @return unsigned long long - nanoseconds to the next open-loop request,
+ * exponentially distributed with mean 1 / rate
+ * **/
+static unsigned long long
+next_gap(unsigned int *seed)
+{
+	// uniform in (0, 1], so the log is finite
+	double u = (rand_r(seed) + 1.0) / (RAND_MAX + 1.0);
+
+	return (unsigned long long)(-log(u) * 1e9 / rate);
+}
+
+static void *
+worker(void *arg)
+{
+	worker_t *w = arg;
+	unsigned long long due = now_ns();
+
+	if (pinned) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(w->id % sysconf(_SC_NPROCESSORS_ONLN), &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+	while (!stop) {
+		int read = (int)(rand_r(&w->seed) % 100) < read_pct;
+		int priority = read ? -1 : pick_priority(&w->seed);
+		unsigned long long start;
+
+		if (rate > 0) {
+			// sleep until due, unless we are already late
+			due += next_gap(&w->seed);
+			start = due;
+			if (now_ns() < due) {
+				struct timespec ts = {
+					.tv_sec = due / 1000000000ull,
+					.tv_nsec = due % 1000000000ull,
+				};
+				while (clock_nanosleep(CLOCK_MONOTONIC,
+				    TIMER_ABSTIME, &ts, NULL) == EINTR) {
+				}
+			}
+		} else {
+			start = now_ns();
+		}
+
+		if (read) {
+			rwl_rlock(&lock);
+		} else {
+			rwl_wlock(&lock, priority);
+		}
+		hist_record(&w->hist[priority + 1], now_ns() - start);
+		critical_section();
+		if (read) {
+			rwl_runlock(&lock);
+		} else {
+			rwl_wunlock(&lock, priority);
+		}
+	}
+	return NULL;
+}
+
+static void
+print_hist(const char *who, const hist_t *h)
+{
+	printf("%s,%llu,%llu,%llu,%llu,%llu\n", who, h->total,
+	    hist_quantile(h, 0.5), hist_quantile(h, 0.99),
+	    hist_quantile(h, 0.999), h->max);
+}
+
+static void
+usage(FILE *fp, const char *prog)
+{
+	fprintf(fp, "usage: %s [-t threads] [-r read%%] [-c cs_loops] "
+	    "[-d seconds] [-w mix] [-R rate] [-b] [-a] [-f] [-p] [-h]\n", prog);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int nthreads = 4;
+	int seconds = 2;
+	rwl_attr attr;
+	int opt;
+
+	rwl_attr_init(&attr);
+	mix_uniform();
+	while ((opt = getopt(argc, argv, "t:r:c:d:w:R:bafph")) != -1) {
+		switch (opt) {
+		case 't': nthreads = atoi(optarg); break;
+		case 'r': read_pct = atoi(optarg); break;
+		case 'c': cs_loops = atoi(optarg); break;
+		case 'd': seconds = atoi(optarg); break;
+		case 'w':
+			if (parse_mix(optarg) != 0) {
+				fprintf(stderr, "bad priority mix %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'R': rate = atof(optarg); break;
+		case 'b': attr.flags |= RWL_BIGREADER; break;
+		case 'a': attr.flags |= RWL_ADAPTIVE; break;
+		case 'f': attr.flags |= RWL_PHASE_FAIR; break;
+		case 'p': pinned = 1; break;
+		case 'h':
+			usage(stdout, argv[0]);
+			return 0;
+		default:
+			usage(stderr, argv[0]);
+			return 1;
+		}
+	}
+	if (nthreads < 1 || rwl_init_attr(&lock, &attr) != 0) {
+		fprintf(stderr, "rwl_init_attr failed\n");
+		return 1;
+	}
+
+	pthread_t *th = calloc(nthreads, sizeof(*th));
+	worker_t *w = calloc(nthreads, sizeof(*w));
+	hist_t *sum = calloc(CLASSES, sizeof(*sum));
+	if (th == NULL || w == NULL || sum == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (int i = 0; i < nthreads; i++) {
+		w[i].seed = i + 1;
+		w[i].id = i;
+		w[i].hist = calloc(CLASSES, sizeof(hist_t));
+		if (w[i].hist == NULL) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+		pthread_create(&th[i], NULL, worker, &w[i]);
+	}
+	sleep(seconds);
+	stop = 1;
+	for (int i = 0; i < nthreads; i++) {
+		pthread_join(th[i], NULL);
+		for (int c = 0; c < CLASSES; c++) {
+			hist_merge(&sum[c], &w[i].hist[c]);
+		}
+		free(w[i].hist);
+	}
+
+	printf("who,ops,p50_ns,p99_ns,p999_ns,max_ns\n");
+	print_hist("read", &sum[0]);
+	for (int p = 0; p < RWL_LEVELS; p++) {
+		char who[16];
+		snprintf(who, sizeof(who), "write%d", p);
+		print_hist(who, &sum[p + 1]);
+	}
+
+	rwl_destroy(&lock);
+	free(sum);
+	free(th);
+	free(w);
+	return 0;
+}
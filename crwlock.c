@@ -0,0 +1,364 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <assert.h>
+#include "crwlock.h"
+#ifdef RWL_FUTEX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+/* crwl follows the cohort recipe of Dice, Marathe and Shavit.
+ *
+ * A writer first takes the local rwl of its node, with its own priority,
+ * so writers of one node queue up there in priority order.  The owner of
+ * the local lock then takes l->global, also with its priority, which is
+ * where the nodes compete; priorities are thus honoured within a node and
+ * between the writers at the head of each node, but not between a node's
+ * head and the writers behind it.  Once inside, the writer sets l->w_in
+ * and waits for every node's reader count to drain.
+ *
+ * On release, a writer whose node has more writers queued (n->w_waiting)
+ * leaves l->global held, sets n->inherit and only drops the local lock,
+ * and whoever takes it next finds itself inside already.  That is done at
+ * most l->batch times in a row, and not at all if l->urgent shows a
+ * priority 0 writer waiting on another node.
+ *
+ * Readers add themselves to their node's counter and check l->w_in; if a
+ * writer is in they back out again and wait for the writers to be done by
+ * taking l->global for reading, which being writer-preferring also keeps
+ * them out while any other node's writers are queued for it.  A reader may
+ * be migrated between lock and unlock, so single counters can go negative;
+ * only the sum means anything.
+ */
+#define CRWL_MAX_NODES      64
+
+struct crwl_node {
+	rwl                 local;      // this node's writers queue here
+	long                readers RWL_ALIGNED; // readers inside on this node
+	// the rest is written by this node's writers
+	unsigned int        w_waiting RWL_ALIGNED; // writers queued for local
+	unsigned int        w_urgent;   // priority 0 writers of this node
+	int                 inherit;    // local's next owner holds global too
+	int                 batch;      // local handoffs since global was taken
+} RWL_ALIGNED;
+
+#ifndef RWL_FUTEX
+// without futexes draining writers share one condition variable
+static pthread_mutex_t park_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t park_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
+// the CPU to node map, read from sysfs once
+static pthread_once_t topo_once = PTHREAD_ONCE_INIT;
+static int *topo_cpu_node;
+static int topo_ncpu;
+static int topo_nodes = 1;
+
+// the node the calling thread said it runs on, see crwl_bind
+static __thread int home = -1;
+
+// topo_read fills in the CPU to node map from /sys/devices/system/node
+static void
+topo_read(void)
+{
+	char path[64], buf[1024];
+	long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+
+	if (ncpu < 1 || (topo_cpu_node = calloc(ncpu, sizeof(int))) == NULL) {
+		return;
+	}
+	topo_ncpu = (int)ncpu;
+	for (int node = 0; node < CRWL_MAX_NODES; node++) {
+		snprintf(path, sizeof(path),
+		    "/sys/devices/system/node/node%d/cpulist", node);
+		FILE *fp = fopen(path, "r");
+		if (fp == NULL) {
+			// node numbers may have holes
+			continue;
+		}
+		// a list of ranges such as "0-3,8-11"
+		char *p = fgets(buf, sizeof(buf), fp);
+		while (p != NULL && *p >= '0' && *p <= '9') {
+			long lo = strtol(p, &p, 10), hi = lo;
+			if (*p == '-') {
+				hi = strtol(p + 1, &p, 10);
+			}
+			for (long cpu = lo; cpu <= hi && cpu < ncpu; cpu++) {
+				topo_cpu_node[cpu] = node;
+			}
+			if (hi >= lo) {
+				topo_nodes = node + 1;
+			}
+			p = *p == ',' ? p + 1 : NULL;
+		}
+		fclose(fp);
+	}
+}
+
+//crwl_cpu_node returns the NUMA node of a CPU
+int
+crwl_cpu_node(int cpu)
+{
+	pthread_once(&topo_once, topo_read);
+	if (cpu < 0 || cpu >= topo_ncpu) {
+		return 0;
+	}
+	return topo_cpu_node[cpu];
+}
+
+//crwl_bind pins the calling thread to a node as far as crwl is concerned
+void
+crwl_bind(int node)
+{
+	home = node;
+}
+
+/**
+ * @param crwl - lock metadata
+ * @return struct crwl_node * - the node of the calling thread
+ * **/
+static inline struct crwl_node *
+this_node(crwl *l)
+{
+	if (home >= 0) {
+		return &l->nodes[home % l->nnodes];
+	}
+	if (l->nnodes == 1) {
+		return &l->nodes[0];
+	}
+	// glibc serves this from the rseq area, so it does not enter the kernel
+	return &l->nodes[crwl_cpu_node(sched_getcpu()) % l->nnodes];
+}
+
+/**
+ * @param crwl - lock metadata
+ * @return long - the number of readers inside, over all nodes
+ * **/
+static long
+reader_sum(crwl *l)
+{
+	long sum = 0;
+
+	for (int i = 0; i < l->nnodes; i++) {
+		sum += __atomic_load_n(&l->nodes[i].readers, __ATOMIC_SEQ_CST);
+	}
+	return sum;
+}
+
+// drain_wake wakes the writer in drain_readers, if it is asleep
+static void
+drain_wake(crwl *l)
+{
+	unsigned int s = __atomic_load_n(&l->d_seq, __ATOMIC_RELAXED);
+
+	// bit 0 says the writer sleeps; the word counts in steps of two
+	while (!__atomic_compare_exchange_n(&l->d_seq, &s, (s + 2) & ~1u, 0,
+	    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+	}
+	if ((s & 1) == 0) {
+		return;
+	}
+#ifdef RWL_FUTEX
+	syscall(SYS_futex, &l->d_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL,
+	    0);
+#else
+	pthread_mutex_lock(&park_mutex);
+	pthread_cond_broadcast(&park_cond);
+	pthread_mutex_unlock(&park_mutex);
+#endif
+}
+
+// drain_readers waits, as the writer that just set l->w_in, for every
+// reader already inside to leave
+static void
+drain_readers(crwl *l)
+{
+	for (;;) {
+		unsigned int s = __atomic_load_n(&l->d_seq, __ATOMIC_ACQUIRE);
+		if (reader_sum(l) == 0) {
+			return;
+		}
+		if ((s & 1) == 0 && !__atomic_compare_exchange_n(&l->d_seq, &s,
+		    s | 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			continue;
+		}
+#ifdef RWL_FUTEX
+		syscall(SYS_futex, &l->d_seq, FUTEX_WAIT_PRIVATE, s | 1, NULL,
+		    NULL, 0);
+#else
+		pthread_mutex_lock(&park_mutex);
+		while (__atomic_load_n(&l->d_seq, __ATOMIC_ACQUIRE) == (s | 1)) {
+			pthread_cond_wait(&park_cond, &park_mutex);
+		}
+		pthread_mutex_unlock(&park_mutex);
+#endif
+	}
+}
+
+// reader_leave drops a read count, waking a draining writer
+static void
+reader_leave(crwl *l, struct crwl_node *n)
+{
+	__atomic_sub_fetch(&n->readers, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&l->w_in, __ATOMIC_SEQ_CST) != 0) {
+		drain_wake(l);
+	}
+}
+
+//crwl_init initializes the cohort lock
+int
+crwl_init(crwl *l, int nodes, int batch)
+{
+	rwl_attr attr;
+	int rc;
+
+	if (nodes < 0 || batch < 0) {
+		return EINVAL;
+	}
+	pthread_once(&topo_once, topo_read);
+	if (nodes == 0) {
+		nodes = topo_nodes;
+	}
+	l->nodes = aligned_alloc(RWL_CACHELINE, nodes * sizeof(*l->nodes));
+	if (l->nodes == NULL) {
+		return ENOMEM;
+	}
+	// batching counts handoffs, and the nodes take turns for l->global
+	// only if nobody can barge past them
+	rwl_attr_init(&attr);
+	attr.flags = RWL_FIFO;
+	rc = rwl_init_attr(&l->global, &attr);
+	for (int i = 0; i < nodes && rc == 0; i++) {
+		rc = rwl_init_attr(&l->nodes[i].local, &attr);
+		if (rc != 0) {
+			// a failed rwl_init_attr has cleaned up after itself
+			while (--i >= 0) {
+				rwl_destroy(&l->nodes[i].local);
+			}
+			rwl_destroy(&l->global);
+		}
+	}
+	if (rc != 0) {
+		free(l->nodes);
+		l->nodes = NULL;
+		return rc;
+	}
+	for (int i = 0; i < nodes; i++) {
+		struct crwl_node *n = &l->nodes[i];
+		n->readers = 0;
+		n->w_waiting = 0;
+		n->w_urgent = 0;
+		n->inherit = 0;
+		n->batch = 0;
+	}
+	l->nnodes = nodes;
+	l->batch = batch;
+	l->w_in = 0;
+	l->d_seq = 0;
+	l->urgent = 0;
+	l->w_node = -1;
+	l->w_prio = -1;
+	return 0;
+}
+
+//crwl_destroy releases what crwl_init allocated; the lock must be idle
+void
+crwl_destroy(crwl *l)
+{
+	assert(l->w_in == 0 && reader_sum(l) == 0);
+	for (int i = 0; i < l->nnodes; i++) {
+		rwl_destroy(&l->nodes[i].local);
+	}
+	rwl_destroy(&l->global);
+	free(l->nodes);
+	l->nodes = NULL;
+}
+
+//crwl_rlock attempts to grab the lock in "read" mode
+void
+crwl_rlock(crwl *l)
+{
+	for (;;) {
+		struct crwl_node *n = this_node(l);
+
+		// pairs with drain_readers: either we see l->w_in or the
+		// writer sees our count
+		__atomic_add_fetch(&n->readers, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&l->w_in, __ATOMIC_SEQ_CST) == 0) {
+			return;
+		}
+		reader_leave(l, n);
+		// sleep until no writer holds or wants the global lock
+		rwl_rlock(&l->global);
+		rwl_runlock(&l->global);
+	}
+}
+
+//crwl_runlock unlocks the lock held in the "read" mode
+void
+crwl_runlock(crwl *l)
+{
+	reader_leave(l, this_node(l));
+}
+
+//crwl_wlock attempts to grab the lock in "write" mode
+void
+crwl_wlock(crwl *l, int priority)
+{
+	struct crwl_node *n = this_node(l);
+
+	assert(priority >= 0 && priority < RWL_LEVELS);
+	__atomic_add_fetch(&n->w_waiting, 1, __ATOMIC_SEQ_CST);
+	if (priority == 0) {
+		// l->urgent first: crwl_wunlock reads them the other way round
+		__atomic_add_fetch(&l->urgent, 1, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&n->w_urgent, 1, __ATOMIC_SEQ_CST);
+	}
+	rwl_wlock(&n->local, priority);
+	__atomic_sub_fetch(&n->w_waiting, 1, __ATOMIC_SEQ_CST);
+
+	if (n->inherit) {
+		// handed over within the cohort, global lock included
+		n->inherit = 0;
+	} else {
+		rwl_wlock(&l->global, priority);
+		l->w_node = (int)(n - l->nodes);
+		l->w_prio = priority;
+		n->batch = 0;
+		__atomic_store_n(&l->w_in, 1, __ATOMIC_SEQ_CST);
+		drain_readers(l);
+	}
+	if (priority == 0) {
+		__atomic_sub_fetch(&n->w_urgent, 1, __ATOMIC_SEQ_CST);
+		__atomic_sub_fetch(&l->urgent, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+//crwl_wunlock unlocks the lock held in the "write" mode
+void
+crwl_wunlock(crwl *l, int priority)
+{
+	// the node we locked, wherever we run now
+	struct crwl_node *n = &l->nodes[l->w_node];
+	unsigned int mine = __atomic_load_n(&n->w_urgent, __ATOMIC_SEQ_CST);
+
+	assert(priority >= 0 && priority < RWL_LEVELS);
+	if (n->batch < l->batch &&
+	    __atomic_load_n(&n->w_waiting, __ATOMIC_SEQ_CST) != 0 &&
+	    __atomic_load_n(&l->urgent, __ATOMIC_SEQ_CST) == mine) {
+		// a writer of ours is queued and nobody more urgent elsewhere
+		n->batch++;
+		n->inherit = 1;
+		rwl_wunlock(&n->local, priority);
+		return;
+	}
+	__atomic_store_n(&l->w_in, 0, __ATOMIC_SEQ_CST);
+	rwl_wunlock(&l->global, l->w_prio);
+	rwl_wunlock(&n->local, priority);
+}
@@ -0,0 +1,60 @@
+#ifndef CRWLOCK_H
+#define CRWLOCK_H
+
+#include "rwlock.h"
+
+#pragma GCC visibility push(default)
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* crwl is a NUMA-aware cohort lock built out of rwl.  Each NUMA node has a
+ * local rwl that its writers queue on and a reader counter of its own;
+ * one global rwl decides which node's cohort of writers is inside.  A
+ * writer releasing the lock hands it to the next writer of its own node,
+ * global lock and all, up to batch times in a row before letting other
+ * nodes have a go, so the lock and the data it protects stay in one
+ * socket's caches.  A priority 0 writer waiting on another node ends the
+ * batch at the next release.  Readers only touch their own node's counter
+ * unless a writer is inside.
+ */
+
+struct crwl_node;
+
+typedef struct {
+	rwl                 global;     // held for writing by the cohort inside
+
+	// read by every reader
+	struct crwl_node   *nodes RWL_ALIGNED; // one per NUMA node
+	int                 nnodes;
+	int                 batch;      // local handoffs before passing it on
+	unsigned int        w_in;       // a writer cohort holds global
+	unsigned int        d_seq;      // a writer waiting out readers sleeps here
+
+	// only written by writers
+	unsigned int        urgent RWL_ALIGNED; // priority 0 writers waiting
+	int                 w_node;     // node of the cohort inside
+	int                 w_prio;     // priority global was taken with
+} RWL_ALIGNED crwl;
+
+// nodes is the number of NUMA nodes to tell apart, or 0 for all of them;
+// returns 0, EINVAL or ENOMEM
+int crwl_init(crwl *l, int nodes, int batch);
+void crwl_destroy(crwl *l);
+void crwl_rlock(crwl *l);
+void crwl_runlock(crwl *l);
+void crwl_wlock(crwl *l, int priority);
+void crwl_wunlock(crwl *l, int priority);
+
+// the calling thread counts as running on node from now on, or on the node
+// of its current CPU again if node is -1
+void crwl_bind(int node);
+// the NUMA node of cpu, 0 if unknown
+int crwl_cpu_node(int cpu);
+
+#ifdef __cplusplus
+}
+#endif
+#pragma GCC visibility pop
+
+#endif
@@ -0,0 +1,595 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <assert.h>
+#include "prwlock.h"
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+/* Every change to prwl's state and every slot bookkeeping is done under
+ * l->mutex, which is robust: if a process dies holding it the next one to
+ * take it is told, and since all the mutex guards can be worked out again
+ * from the live slots and w_owner, it does so and carries on.  Readers
+ * only take it if a writer is in or waiting.  Otherwise a reader adds
+ * itself to its process's slot and checks l->state, as RWL_BIGREADER
+ * readers do with their CPU's slot, and a writer sets PRWL_WRITER and
+ * then waits for the slots to add up to zero.
+ *
+ * Waiters sleep on futexes, which keep no state in user space for a dead
+ * waiter to leave behind; process-shared condition variables do.  They
+ * are shared futexes, not FUTEX_*_PRIVATE, as each process maps the lock
+ * where it likes.  Every sleep ends after PRWL_POLL_MS, and a waiter that
+ * wakes from one that way looks for dead processes: their slots are
+ * cleared, and a dead writer inside is let go and l->state marked
+ * PRWL_DEAD.  A process is dead when it, or the process since given its
+ * pid, has a different start time, or when it is a zombie; a process that
+ * could not read its own start time is only dead once its pid is free.
+ * Telling that means reading /proc, so it is done without l->mutex, and
+ * the mutex only taken afterwards to clear the slots that the same
+ * processes still hold.
+ */
+#define PRWL_WRITER         0x1u    // a writer is in, or waiting out readers
+#define PRWL_W_WAIT         0x2u    // writers are waiting
+#define PRWL_DEAD           0x4u    // a writer died inside
+#define PRWL_SEQ_SLEEPERS   0x1u    // somebody sleeps on a sequence word
+#define PRWL_POLL_MS        50
+
+// who this process is, read once and again after a fork
+static pthread_once_t self_once = PTHREAD_ONCE_INIT;
+static int self_pid;
+static unsigned long long self_start;
+
+// the slot of the lock this thread used last
+static __thread prwl *c_lock;
+static __thread int c_pid;
+static __thread int c_slot;
+
+static inline unsigned int
+state_load(prwl *l)
+{
+	return __atomic_load_n(&l->state, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @param pid - process to look up
+ * @param start - set to when pid started, in clock ticks since boot
+ * @return int - 0, -1 if there is no such process or it is a zombie, or 1
+ * if that cannot be told
+ * **/
+static int
+proc_start(int pid, unsigned long long *start)
+{
+	if (kill(pid, 0) != 0 && errno == ESRCH) {
+		return -1;
+	}
+#ifdef __linux__
+	char path[64], buf[1024], *p;
+	FILE *fp;
+	int i;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		return errno == ENOENT && kill(pid, 0) != 0 ? -1 : 1;
+	}
+	p = fgets(buf, sizeof(buf), fp);
+	fclose(fp);
+	// the command name may hold anything, so fields count from its ')'
+	if (p == NULL || (p = strrchr(buf, ')')) == NULL || p[1] != ' ') {
+		return 1;
+	}
+	if (p[2] == 'Z' || p[2] == 'X') {
+		return -1;
+	}
+	// the state is field 3 and the start time field 22
+	for (i = 0; i < 20 && p != NULL; i++) {
+		p = strchr(p + 1, ' ');
+	}
+	if (p == NULL) {
+		return 1;
+	}
+	*start = strtoull(p + 1, NULL, 10);
+	return 0;
+#else
+	(void)start;
+	return 1;
+#endif
+}
+
+/* dead tells whether the process that took a slot as pid at start has
+ * gone; start is 0 if that process could not read its own, and then only
+ * a pid nobody has is taken for dead */
+static int
+dead(int pid, unsigned long long start)
+{
+	unsigned long long now;
+
+	switch (proc_start(pid, &now)) {
+	case 0:
+		return start != 0 && now != start;
+	case 1:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+//forked makes a child find out who it is afresh
+static void
+forked(void)
+{
+	__atomic_store_n(&self_pid, 0, __ATOMIC_RELAXED);
+}
+
+static void
+self_init(void)
+{
+	pthread_atfork(NULL, NULL, forked);
+}
+
+//self returns this process's pid, after reading its start time if need be
+static int
+self(void)
+{
+	int pid = __atomic_load_n(&self_pid, __ATOMIC_ACQUIRE);
+	unsigned long long start;
+
+	if (pid != 0) {
+		return pid;
+	}
+	pthread_once(&self_once, self_init);
+	pid = getpid();
+	if (proc_start(pid, &start) != 0) {
+		start = 0;
+	}
+	__atomic_store_n(&self_start, start, __ATOMIC_RELAXED);
+	__atomic_store_n(&self_pid, pid, __ATOMIC_RELEASE);
+	return pid;
+}
+
+/**
+ * @param word - sequence word to sleep on
+ * @param seq - value read from word before checking the lock state
+ * @return int - ETIMEDOUT if it slept a whole poll period, 0 otherwise
+ * **/
+static int
+park(unsigned int *word, unsigned int seq)
+{
+	unsigned int cur = seq;
+	struct timespec ts = { 0, PRWL_POLL_MS * 1000000L };
+
+	seq |= PRWL_SEQ_SLEEPERS;
+	if (cur != seq && !__atomic_compare_exchange_n(word, &cur, seq, 0,
+	    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) && cur != seq) {
+		return 0;
+	}
+#ifdef __linux__
+	// FUTEX_WAIT takes a relative timeout
+	if (syscall(SYS_futex, word, FUTEX_WAIT, seq, &ts, NULL, 0) != 0 &&
+	    errno == ETIMEDOUT) {
+		return ETIMEDOUT;
+	}
+	return 0;
+#else
+	// nothing to sleep on, so poll a little more often
+	ts.tv_nsec /= 50;
+	nanosleep(&ts, NULL);
+	return __atomic_load_n(word, __ATOMIC_ACQUIRE) == seq ? ETIMEDOUT : 0;
+#endif
+}
+
+// unpark bumps a sequence word and wakes everybody sleeping on it
+static void
+unpark(unsigned int *word)
+{
+	unsigned int seq = __atomic_load_n(word, __ATOMIC_RELAXED);
+
+	while (!__atomic_compare_exchange_n(word, &seq,
+	    (seq + 2) & ~PRWL_SEQ_SLEEPERS, 0, __ATOMIC_ACQ_REL,
+	    __ATOMIC_RELAXED)) {
+	}
+#ifdef __linux__
+	if ((seq & PRWL_SEQ_SLEEPERS) != 0) {
+		syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+#endif
+}
+
+/* next_up picks the word to unpark when the lock may have come free: that
+ * of the highest priority writers waiting, or else the readers'; called
+ * with l->mutex held */
+static unsigned int *
+next_up(prwl *l)
+{
+	int q;
+
+	if ((state_load(l) & PRWL_WRITER) != 0) {
+		return NULL;
+	}
+	for (q = 0; q < RWL_LEVELS; q++) {
+		if (l->w_wait[q] != 0) {
+			return &l->w_seq[q];
+		}
+	}
+	return &l->r_seq;
+}
+
+static void guard(prwl *l);
+static void unguard(prwl *l);
+
+/* recount works out l->state and l->w_wait again from w_owner and the
+ * slots, and wakes whoever may now go in, as after readers were drained or
+ * a process died holding l->mutex; called with l->mutex held */
+static void
+recount(prwl *l, int drained)
+{
+	unsigned int s, *w;
+	int i, q;
+
+	// the writer bit follows w_owner, and the waiting bit the counts
+	s = l->w_owner != 0 ? PRWL_WRITER : 0;
+	for (q = 0; q < RWL_LEVELS; q++) {
+		l->w_wait[q] = 0;
+		for (i = 0; i < PRWL_PROCS; i++) {
+			l->w_wait[q] += l->procs[i].w_wait[q];
+		}
+		if (l->w_wait[q] != 0) {
+			s |= PRWL_W_WAIT;
+		}
+	}
+	s |= state_load(l) & PRWL_DEAD;
+	__atomic_store_n(&l->state, s, __ATOMIC_SEQ_CST);
+
+	if (drained) {
+		unpark(&l->d_seq);
+	}
+	w = next_up(l);
+	if (w != NULL) {
+		unpark(w);
+	}
+}
+
+/**
+ * find_dead looks for slots of processes that have gone, without l->mutex
+ * @param rwl - lock metadata
+ * @param pid - set to the pid of each slot found dead, 0 for the others
+ * @param start - set to the start time that went with it
+ * @return int - how many slots were found dead
+ * **/
+static int
+find_dead(prwl *l, int pid[PRWL_PROCS], unsigned long long start[PRWL_PROCS])
+{
+	int i, n = 0;
+
+	for (i = 0; i < PRWL_PROCS; i++) {
+		struct prwl_proc *p = &l->procs[i];
+
+		pid[i] = __atomic_load_n(&p->pid, __ATOMIC_ACQUIRE);
+		start[i] = __atomic_load_n(&p->start, __ATOMIC_RELAXED);
+		// a slot given out again meanwhile is left for the next look
+		if (pid[i] == 0 ||
+		    __atomic_load_n(&p->pid, __ATOMIC_ACQUIRE) != pid[i] ||
+		    !dead(pid[i], start[i])) {
+			pid[i] = 0;
+			continue;
+		}
+		n++;
+	}
+	return n;
+}
+
+/* reap clears the slots of dead processes, lets go of the lock if its
+ * writer is one of them and wakes whoever that lets through.  Called
+ * without l->mutex, which it only takes if somebody was found dead. */
+static void
+reap(prwl *l)
+{
+	int pid[PRWL_PROCS];
+	unsigned long long start[PRWL_PROCS];
+	int i, drained = 0;
+
+	if (find_dead(l, pid, start) == 0) {
+		return;
+	}
+	guard(l);
+	for (i = 0; i < PRWL_PROCS; i++) {
+		struct prwl_proc *p = &l->procs[i];
+
+		if (pid[i] == 0 || p->pid != pid[i] || p->start != start[i]) {
+			continue;
+		}
+		if (l->w_owner == i + 1) {
+			l->w_owner = 0;
+			__atomic_or_fetch(&l->state, PRWL_DEAD, __ATOMIC_SEQ_CST);
+		}
+		if (__atomic_exchange_n(&p->readers, 0, __ATOMIC_SEQ_CST) != 0) {
+			drained = 1;
+		}
+		memset(p->w_wait, 0, sizeof(p->w_wait));
+		__atomic_store_n(&p->pid, 0, __ATOMIC_RELAXED);
+	}
+	recount(l, drained);
+	unguard(l);
+}
+
+/* guard takes l->mutex, cleaning up after a process that died holding it:
+ * its slot is left for the next reap, but whatever it was changing is
+ * worked out again */
+static void
+guard(prwl *l)
+{
+	int rc = pthread_mutex_lock(&l->mutex);
+
+	if (rc == EOWNERDEAD) {
+		recount(l, 1);
+		rc = pthread_mutex_consistent(&l->mutex);
+	}
+	assert(rc == 0);
+}
+
+static void
+unguard(prwl *l)
+{
+	pthread_mutex_unlock(&l->mutex);
+}
+
+/* sleep_on sleeps on word until it moves on from seq, and looks for dead
+ * processes if that takes a poll period; it is called with l->mutex held,
+ * seq read under it, and returns with it held again */
+static void
+sleep_on(prwl *l, unsigned int *word, unsigned int seq)
+{
+	unguard(l);
+	if (park(word, seq) == ETIMEDOUT) {
+		reap(l);
+	}
+	guard(l);
+}
+
+/**
+ * claim finds this process's slot, or gives it a free one; called with
+ * l->mutex held
+ * @return int - the slot, or -1 if all are taken
+ * **/
+static int
+claim(prwl *l, int pid, unsigned long long start)
+{
+	int i;
+
+	for (i = 0; i < PRWL_PROCS; i++) {
+		if (l->procs[i].pid == pid && l->procs[i].start == start) {
+			return i;
+		}
+	}
+	for (i = 0; i < PRWL_PROCS; i++) {
+		if (l->procs[i].pid == 0) {
+			l->procs[i].start = start;
+			__atomic_store_n(&l->procs[i].pid, pid, __ATOMIC_RELEASE);
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @param rwl - lock metadata
+ * @return struct prwl_proc * - this process's slot, or NULL if all are taken
+ * **/
+static struct prwl_proc *
+my_proc(prwl *l)
+{
+	int pid = self();
+	unsigned long long start;
+	int slot;
+
+	if (c_lock == l && c_pid == pid &&
+	    __atomic_load_n(&l->procs[c_slot].pid, __ATOMIC_RELAXED) == pid) {
+		return &l->procs[c_slot];
+	}
+	start = __atomic_load_n(&self_start, __ATOMIC_RELAXED);
+	guard(l);
+	slot = claim(l, pid, start);
+	unguard(l);
+	if (slot < 0) {
+		// a full table may have room once the dead are gone
+		reap(l);
+		guard(l);
+		slot = claim(l, pid, start);
+		unguard(l);
+	}
+	if (slot < 0) {
+		return NULL;
+	}
+	c_lock = l;
+	c_pid = pid;
+	c_slot = slot;
+	return &l->procs[slot];
+}
+
+//prwl_init initializes the lock, in memory shared with the other processes
+int
+prwl_init(prwl *l)
+{
+	pthread_mutexattr_t ma;
+	int rc;
+
+	memset(l, 0, sizeof(*l));
+	pthread_mutexattr_init(&ma);
+	pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+	rc = pthread_mutex_init(&l->mutex, &ma);
+	pthread_mutexattr_destroy(&ma);
+	return rc;
+}
+
+//prwl_destroy destroys the lock; no process may use it afterwards
+void
+prwl_destroy(prwl *l)
+{
+	pthread_mutex_destroy(&l->mutex);
+}
+
+// leave drops a read hold and tells a writer waiting out readers
+static void
+leave(prwl *l, struct prwl_proc *me)
+{
+	__atomic_sub_fetch(&me->readers, 1, __ATOMIC_SEQ_CST);
+	if ((state_load(l) & PRWL_WRITER) != 0) {
+		unpark(&l->d_seq);
+	}
+}
+
+//prwl_rlock acquires the lock for reading
+int
+prwl_rlock(prwl *l)
+{
+	struct prwl_proc *me = my_proc(l);
+	unsigned int s;
+
+	if (me == NULL) {
+		return EAGAIN;
+	}
+	// a writer sets its bit before adding up the slots, so one of us
+	// sees the other
+	__atomic_add_fetch(&me->readers, 1, __ATOMIC_SEQ_CST);
+	s = state_load(l);
+	if ((s & (PRWL_WRITER | PRWL_W_WAIT)) == 0) {
+		return (s & PRWL_DEAD) != 0 ? EOWNERDEAD : 0;
+	}
+	leave(l, me);
+
+	guard(l);
+	while (((s = state_load(l)) & (PRWL_WRITER | PRWL_W_WAIT)) != 0) {
+		sleep_on(l, &l->r_seq, __atomic_load_n(&l->r_seq, __ATOMIC_RELAXED));
+	}
+	__atomic_add_fetch(&me->readers, 1, __ATOMIC_SEQ_CST);
+	unguard(l);
+	return (s & PRWL_DEAD) != 0 ? EOWNERDEAD : 0;
+}
+
+//prwl_runlock releases the lock held for reading
+void
+prwl_runlock(prwl *l)
+{
+	struct prwl_proc *me = my_proc(l);
+
+	assert(me != NULL && me->readers > 0);
+	leave(l, me);
+}
+
+// blocked tells a writer of priority it has to wait, with l->mutex held
+static int
+blocked(prwl *l, int priority)
+{
+	int q;
+
+	if ((state_load(l) & PRWL_WRITER) != 0) {
+		return 1;
+	}
+	for (q = 0; q < priority; q++) {
+		if (l->w_wait[q] != 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// readers adds up the slots
+static int
+readers(prwl *l)
+{
+	int i, n = 0;
+
+	for (i = 0; i < PRWL_PROCS; i++) {
+		n += __atomic_load_n(&l->procs[i].readers, __ATOMIC_SEQ_CST);
+	}
+	return n;
+}
+
+//prwl_wlock acquires the lock for writing with the given priority
+int
+prwl_wlock(prwl *l, int priority)
+{
+	struct prwl_proc *me = my_proc(l);
+	unsigned int seq;
+	int q;
+
+	assert(priority >= 0 && priority < RWL_LEVELS);
+	if (me == NULL) {
+		return EAGAIN;
+	}
+	guard(l);
+	me->w_wait[priority]++;
+	l->w_wait[priority]++;
+	__atomic_or_fetch(&l->state, PRWL_W_WAIT, __ATOMIC_SEQ_CST);
+	while (blocked(l, priority)) {
+		sleep_on(l, &l->w_seq[priority],
+		    __atomic_load_n(&l->w_seq[priority], __ATOMIC_RELAXED));
+	}
+	me->w_wait[priority]--;
+	l->w_wait[priority]--;
+	l->w_owner = me - l->procs + 1;
+	l->w_prio = priority;
+	__atomic_or_fetch(&l->state, PRWL_WRITER, __ATOMIC_SEQ_CST);
+	for (q = 0; q < RWL_LEVELS && l->w_wait[q] == 0; q++) {
+	}
+	if (q == RWL_LEVELS) {
+		__atomic_and_fetch(&l->state, ~PRWL_W_WAIT, __ATOMIC_SEQ_CST);
+	}
+	unguard(l);
+
+	// wait the readers out; only the dead stay for good
+	for (;;) {
+		seq = __atomic_load_n(&l->d_seq, __ATOMIC_ACQUIRE);
+		if (readers(l) == 0) {
+			break;
+		}
+		if (park(&l->d_seq, seq) == ETIMEDOUT) {
+			reap(l);
+		}
+	}
+	return (state_load(l) & PRWL_DEAD) != 0 ? EOWNERDEAD : 0;
+}
+
+//prwl_wunlock releases the lock held for writing at the given priority
+void
+prwl_wunlock(prwl *l, int priority)
+{
+	unsigned int *w;
+
+	guard(l);
+	assert(l->w_owner != 0 && l->w_prio == priority);
+	l->w_owner = 0;
+	__atomic_and_fetch(&l->state, ~PRWL_WRITER, __ATOMIC_SEQ_CST);
+	w = next_up(l);
+	unguard(l);
+	// whoever reads the word from here on sees the lock free
+	if (w != NULL) {
+		unpark(w);
+	}
+}
+
+//prwl_consistent marks the data sound again after a writer died inside
+int
+prwl_consistent(prwl *l)
+{
+	int rc = 0;
+
+	guard(l);
+	assert(l->w_owner != 0);
+	if ((state_load(l) & PRWL_DEAD) == 0) {
+		rc = EINVAL;
+	}
+	__atomic_and_fetch(&l->state, ~PRWL_DEAD, __ATOMIC_SEQ_CST);
+	unguard(l);
+	return rc;
+}
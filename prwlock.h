@@ -0,0 +1,74 @@
+#ifndef PRWLOCK_H
+#define PRWLOCK_H
+
+#include "rwlock.h"
+
+#pragma GCC visibility push(default)
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* prwl is a reader-writer lock shared by several processes, made to live in
+ * memory they all map: a MAP_SHARED mapping of a file or a shm_open
+ * segment, at any address in each.  It follows rwl's rules, except that
+ * writers of one priority are not served in order of arrival and that, as
+ * with RWL_BIGREADER, a writer that finds only readers inside keeps every
+ * later writer out while it waits for them to leave.  Nothing in it is a
+ * pointer and nothing is allocated.
+ *
+ * Each process using the lock gets one of PRWL_PROCS slots in it, where
+ * its readers count themselves and its waiting writers sign in.  Whoever
+ * waits for a process that has died finds out within a poll period and
+ * clears its slot, so a reader or a waiter dying costs nothing.  A writer
+ * dying inside leaves the data in doubt: the lock is let go, and every
+ * acquisition returns EOWNERDEAD, with the lock held, until a writer that
+ * has repaired the data calls prwl_consistent.
+ */
+#define PRWL_PROCS          16
+
+struct prwl_proc {
+	int                 pid;        // 0: slot free
+	int                 readers;    // read holds of this process
+	unsigned long long  start;      // when pid started, to tell it from reuse
+	int                 w_wait[RWL_LEVELS]; // its writers waiting, per level
+} RWL_ALIGNED;
+
+typedef struct {
+	unsigned int        state;      // writer, waiting and dead bits
+	unsigned int        r_seq;      // waiting readers sleep here
+	unsigned int        d_seq;      // a writer waiting out readers sleeps here
+
+	// everything below is protected by mutex
+	pthread_mutex_t     mutex RWL_ALIGNED; // robust and process-shared
+	int                 w_owner;    // slot + 1 of the writer inside, or 0
+	int                 w_prio;     // the priority it took the lock at
+	int                 w_wait[RWL_LEVELS]; // waiting writers of every slot
+	unsigned int        w_seq[RWL_LEVELS]; // waiting writers sleep here
+
+	struct prwl_proc    procs[PRWL_PROCS];
+} RWL_ALIGNED prwl;
+
+// one process initializes the lock in the shared mapping before any uses
+// it; returns 0 or an error from pthread_mutex_init
+int prwl_init(prwl *l);
+void prwl_destroy(prwl *l);
+
+/* The acquisitions return 0, or EOWNERDEAD with the lock held if a writer
+ * died inside and the data has not been marked consistent since, or EAGAIN
+ * if PRWL_PROCS other live processes use the lock already. */
+int prwl_rlock(prwl *l);
+void prwl_runlock(prwl *l);
+int prwl_wlock(prwl *l, int priority);
+// priority must be the one the lock was taken at, as with rwl_wunlock
+void prwl_wunlock(prwl *l, int priority);
+
+// with the lock held for writing, after repairing what a dead writer left;
+// returns 0, or EINVAL if the data was not in doubt
+int prwl_consistent(prwl *l);
+
+#ifdef __cplusplus
+}
+#endif
+#pragma GCC visibility pop
+
+#endif
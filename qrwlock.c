@@ -0,0 +1,415 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+#include <pthread.h>
+#include <assert.h>
+#include "qrwlock.h"
+#ifdef RWL_FUTEX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+/* qrwl keeps rwl's fast paths: one CAS on l->state to take or release the
+ * lock when nobody is queued.
+ *
+ *   bit 0        QRWL_WRITER     a writer holds the lock
+ *   bit 1        QRWL_WAIT       at least one thread is queued
+ *   bits 2..31   reader count, in units of QRWL_READER
+ *
+ * A thread that has to wait takes the guard, sets QRWL_WAIT with a CAS
+ * against a state in which the lock is held, links a node from its own
+ * stack into a queue and drops the guard again.  The release that later
+ * frees the lock sees QRWL_WAIT, takes the guard and grants the lock to
+ * the next node, adjusting l->state on the node's behalf, so the new
+ * owner wakes up holding the lock and never looks at shared state.  Nodes
+ * are only queued while the lock is held and QRWL_WAIT only changes under
+ * the guard, so a free lock with QRWL_WAIT set always has a release on
+ * its way into release_slow.
+ *
+ * Waiting writers go in l->w_head[p]..l->w_tail[p], waiting readers in the
+ * l->r_head list.  Readers are only queued behind a writer, holding or
+ * waiting, and once no writer is left they are all granted in one go.
+ */
+#define QRWL_WRITER         0x1u
+#define QRWL_WAIT           0x2u
+#define QRWL_READER         0x4u
+#define QRWL_READER_MASK    (~(QRWL_READER - 1))
+#define QRWL_LEVEL(p)       (1ull << (p))
+#define QRWL_SPIN           128
+
+// values of qrwl_node.grant
+#define NODE_WAITING        0u
+#define NODE_SLEEPING       1u
+#define NODE_GRANTED        2u
+
+struct qrwl_node {
+	struct qrwl_node   *next;
+	unsigned int        grant;
+} __attribute__((aligned(RWL_CACHELINE)));
+
+struct qrwl_mcs {
+	struct qrwl_mcs    *next;
+	unsigned int        locked;
+};
+
+#ifndef RWL_FUTEX
+// without futexes all sleeping nodes share one condition variable
+static pthread_mutex_t park_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t park_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
+static inline void
+cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+// backoff pauses in a spin loop, giving the CPU away now and then in case
+// the thread we are waiting for is not running
+static inline void
+backoff(int *rounds)
+{
+	if ((++*rounds & 63) == 0) {
+		sched_yield();
+	} else {
+		cpu_relax();
+	}
+}
+
+static inline unsigned int
+state_load(qrwl *l)
+{
+	return __atomic_load_n(&l->state, __ATOMIC_ACQUIRE);
+}
+
+static inline int
+state_cas(qrwl *l, unsigned int *expected, unsigned int desired)
+{
+	return __atomic_compare_exchange_n(&l->state, expected, desired, 0,
+	    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+// guard_lock takes the MCS lock protecting the queues, spinning on me
+static void
+guard_lock(qrwl *l, struct qrwl_mcs *me)
+{
+	struct qrwl_mcs *prev;
+	int rounds = 0;
+
+	me->next = NULL;
+	me->locked = 1;
+	prev = __atomic_exchange_n(&l->guard, me, __ATOMIC_ACQ_REL);
+	if (prev == NULL) {
+		return;
+	}
+	__atomic_store_n(&prev->next, me, __ATOMIC_RELEASE);
+	while (__atomic_load_n(&me->locked, __ATOMIC_ACQUIRE)) {
+		backoff(&rounds);
+	}
+}
+
+// guard_unlock passes the MCS lock on to the next thread spinning for it
+static void
+guard_unlock(qrwl *l, struct qrwl_mcs *me)
+{
+	struct qrwl_mcs *next = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE);
+	int rounds = 0;
+
+	if (next == NULL) {
+		struct qrwl_mcs *expected = me;
+		if (__atomic_compare_exchange_n(&l->guard, &expected, NULL, 0,
+		    __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			return;
+		}
+		// a successor swapped itself in but has not linked up yet
+		while ((next = __atomic_load_n(&me->next,
+		    __ATOMIC_ACQUIRE)) == NULL) {
+			backoff(&rounds);
+		}
+	}
+	__atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+// node_wait spins, then sleeps, until the lock has been granted to n
+static void
+node_wait(qrwl *l, struct qrwl_node *n)
+{
+	unsigned int g = NODE_WAITING;
+
+	for (int i = 0; i < l->spin; i++) {
+		if (__atomic_load_n(&n->grant, __ATOMIC_ACQUIRE) ==
+		    NODE_GRANTED) {
+			return;
+		}
+		cpu_relax();
+	}
+	if (!__atomic_compare_exchange_n(&n->grant, &g, NODE_SLEEPING, 0,
+	    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+#ifdef RWL_FUTEX
+	while (__atomic_load_n(&n->grant, __ATOMIC_ACQUIRE) != NODE_GRANTED) {
+		syscall(SYS_futex, &n->grant, FUTEX_WAIT_PRIVATE,
+		    NODE_SLEEPING, NULL, NULL, 0);
+	}
+#else
+	pthread_mutex_lock(&park_mutex);
+	while (__atomic_load_n(&n->grant, __ATOMIC_ACQUIRE) != NODE_GRANTED) {
+		pthread_cond_wait(&park_cond, &park_mutex);
+	}
+	pthread_mutex_unlock(&park_mutex);
+#endif
+}
+
+/**
+ * node_grant tells the owner of n that it holds the lock now.  n may be
+ * gone by the time this returns; waking a stale address is harmless, as
+ * every sleeper rechecks its own word.
+ * @param n - a node already unlinked from its queue
+ * **/
+static void
+node_grant(struct qrwl_node *n)
+{
+	unsigned int *word = &n->grant;
+
+	if (__atomic_exchange_n(word, NODE_GRANTED, __ATOMIC_ACQ_REL) !=
+	    NODE_SLEEPING) {
+		return;
+	}
+#ifdef RWL_FUTEX
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+	pthread_mutex_lock(&park_mutex);
+	pthread_cond_broadcast(&park_cond);
+	pthread_mutex_unlock(&park_mutex);
+#endif
+}
+
+/**
+ * release_slow passes a lock that has waiters on, to the first writer of
+ * the highest priority queued or else to every queued reader
+ * @param rwl - lock metadata
+ * @param held - QRWL_WRITER if a writer is letting go, 0 if the last
+ * reader already dropped its count
+ * **/
+static void
+release_slow(qrwl *l, unsigned int held)
+{
+	struct qrwl_mcs me;
+	struct qrwl_node *wake = NULL;
+	unsigned int s, next;
+
+	guard_lock(l, &me);
+	s = state_load(l);
+	do {
+		if ((s & (QRWL_READER_MASK | QRWL_WRITER)) != held) {
+			// somebody took the free lock while we waited for the
+			// guard; their release will see QRWL_WAIT
+			guard_unlock(l, &me);
+			return;
+		}
+		next = s & ~(QRWL_WRITER | QRWL_WAIT);
+		if (l->w_mask != 0) {
+			next |= QRWL_WRITER;
+			if ((l->w_mask & (l->w_mask - 1)) != 0 ||
+			    l->w_head[__builtin_ctzll(l->w_mask)]->next != NULL ||
+			    l->r_head != NULL) {
+				next |= QRWL_WAIT;
+			}
+		} else {
+			for (struct qrwl_node *n = l->r_head; n; n = n->next) {
+				next += QRWL_READER;
+			}
+		}
+	} while (!state_cas(l, &s, next));
+
+	if (l->w_mask != 0) {
+		int p = __builtin_ctzll(l->w_mask);
+		wake = l->w_head[p];
+		l->w_head[p] = wake->next;
+		if (l->w_head[p] == NULL) {
+			l->w_tail[p] = NULL;
+			l->w_mask &= ~QRWL_LEVEL(p);
+		}
+		wake->next = NULL;
+	} else {
+		wake = l->r_head;
+		l->r_head = NULL;
+	}
+	guard_unlock(l, &me);
+
+	while (wake != NULL) {
+		struct qrwl_node *n = wake;
+		wake = n->next;
+		node_grant(n);
+	}
+}
+
+//qrwl_init initializes the queue-based reader-writer lock
+void
+qrwl_init(qrwl *l)
+{
+	l->state = 0;
+	// spinning only helps if the thread we wait for can run meanwhile
+	l->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? QRWL_SPIN : 0;
+	l->guard = NULL;
+	l->w_mask = 0;
+	l->r_head = NULL;
+	for (int i = 0; i < RWL_LEVELS; i++) {
+		l->w_head[i] = NULL;
+		l->w_tail[i] = NULL;
+		l->w_active[i] = 0;
+	}
+}
+
+//qrwl_destroy releases the lock; it must be idle
+void
+qrwl_destroy(qrwl *l)
+{
+	assert(l->state == 0 && l->guard == NULL);
+}
+
+//qrwl_rlock attempts to grab the lock in "read" mode
+void
+qrwl_rlock(qrwl *l)
+{
+	struct qrwl_node self;
+	struct qrwl_mcs me;
+	unsigned int s;
+
+	if (qrwl_tryrlock(l) == 0) {
+		return;
+	}
+
+	guard_lock(l, &me);
+	s = state_load(l);
+	for (;;) {
+		// no writer holds or waits: join the readers inside
+		if ((s & QRWL_WRITER) == 0 && l->w_mask == 0) {
+			if (state_cas(l, &s, s + QRWL_READER)) {
+				guard_unlock(l, &me);
+				return;
+			}
+			continue;
+		}
+		if (state_cas(l, &s, s | QRWL_WAIT)) {
+			break;
+		}
+	}
+	self.grant = NODE_WAITING;
+	self.next = l->r_head;
+	l->r_head = &self;
+	guard_unlock(l, &me);
+
+	node_wait(l, &self);
+}
+
+//qrwl_tryrlock grabs the lock in "read" mode if that needs no waiting
+int
+qrwl_tryrlock(qrwl *l)
+{
+	unsigned int s = state_load(l);
+
+	while ((s & (QRWL_WRITER | QRWL_WAIT)) == 0) {
+		if (state_cas(l, &s, s + QRWL_READER)) {
+			return 0;
+		}
+	}
+	return EBUSY;
+}
+
+//qrwl_runlock unlocks the lock held in the "read" mode
+void
+qrwl_runlock(qrwl *l)
+{
+	unsigned int s = __atomic_sub_fetch(&l->state, QRWL_READER,
+	    __ATOMIC_ACQ_REL);
+
+	if ((s & QRWL_READER_MASK) == 0 && (s & QRWL_WAIT) != 0) {
+		release_slow(l, 0);
+	}
+}
+
+//qrwl_wlock attempts to grab the lock in "write" mode
+void
+qrwl_wlock(qrwl *l, int priority)
+{
+	struct qrwl_node self;
+	struct qrwl_mcs me;
+	unsigned int s = 0;
+
+	assert(priority >= 0 && priority < RWL_LEVELS);
+	if (state_cas(l, &s, QRWL_WRITER)) {
+		goto acquired;
+	}
+
+	guard_lock(l, &me);
+	s = state_load(l);
+	for (;;) {
+		// free, with nobody of our priority or higher queued: take it
+		if ((s & (QRWL_READER_MASK | QRWL_WRITER)) == 0 &&
+		    (l->w_mask & ((QRWL_LEVEL(priority) << 1) - 1)) == 0) {
+			if (state_cas(l, &s, s | QRWL_WRITER)) {
+				guard_unlock(l, &me);
+				goto acquired;
+			}
+			continue;
+		}
+		if (state_cas(l, &s, s | QRWL_WAIT)) {
+			break;
+		}
+	}
+	self.grant = NODE_WAITING;
+	self.next = NULL;
+	if (l->w_tail[priority] != NULL) {
+		l->w_tail[priority]->next = &self;
+	} else {
+		l->w_head[priority] = &self;
+	}
+	l->w_tail[priority] = &self;
+	l->w_mask |= QRWL_LEVEL(priority);
+	guard_unlock(l, &me);
+
+	node_wait(l, &self);
+acquired:
+	l->w_active[priority]++;
+}
+
+//qrwl_trywlock grabs the lock in "write" mode if that needs no waiting
+int
+qrwl_trywlock(qrwl *l, int priority)
+{
+	unsigned int s = 0;
+
+	assert(priority >= 0 && priority < RWL_LEVELS);
+	// anybody queued means the lock is held, so only a free word will do
+	if (!state_cas(l, &s, QRWL_WRITER)) {
+		return EBUSY;
+	}
+	l->w_active[priority]++;
+	return 0;
+}
+
+//qrwl_wunlock unlocks the lock held in the "write" mode
+void
+qrwl_wunlock(qrwl *l, int priority)
+{
+	unsigned int s = state_load(l);
+
+	assert(l->w_active[priority] == 1);
+	l->w_active[priority]--;
+	while ((s & QRWL_WAIT) == 0) {
+		if (state_cas(l, &s, s & ~QRWL_WRITER)) {
+			return;
+		}
+	}
+	release_slow(l, QRWL_WRITER);
+}
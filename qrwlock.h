@@ -0,0 +1,53 @@
+#ifndef QRWLOCK_H
+#define QRWLOCK_H
+
+#include "rwlock.h"
+
+#pragma GCC visibility push(default)
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* qrwl is a queue-based variant of rwl with the same priority rules: a
+ * waiting writer always goes before waiting readers, and writers go in
+ * priority order, first come first served within a level.  Every waiter
+ * spins, then sleeps, on a node of its own, and whoever releases the lock
+ * grants it to the next node directly, so a handoff touches the lock and
+ * the next waiter's cache line and nothing else.  The queues themselves
+ * are guarded by an MCS spinlock held only to link or unlink a node.
+ */
+
+struct qrwl_node;
+struct qrwl_mcs;
+
+typedef struct {
+	unsigned int        state;      // reader count, writer and waiting bits
+	int                 spin;       // rounds to spin before sleeping
+
+	// everything below is protected by guard
+	struct qrwl_mcs    *guard RWL_ALIGNED; // tail of the MCS guard queue
+	unsigned long long  w_mask;     // bit p set: writers of priority p queued
+	struct qrwl_node   *w_head[RWL_LEVELS]; // queued writers, FIFO per level
+	struct qrwl_node   *w_tail[RWL_LEVELS];
+	struct qrwl_node   *r_head;     // queued readers, granted as one group
+
+	int                 w_active[RWL_LEVELS] RWL_ALIGNED;
+} RWL_ALIGNED qrwl;
+
+void qrwl_init(qrwl *l);
+void qrwl_destroy(qrwl *l);
+void qrwl_rlock(qrwl *l);
+void qrwl_runlock(qrwl *l);
+void qrwl_wlock(qrwl *l, int priority);
+void qrwl_wunlock(qrwl *l, int priority);
+
+// non-blocking variants: return 0 with the lock held, or EBUSY
+int qrwl_tryrlock(qrwl *l);
+int qrwl_trywlock(qrwl *l, int priority);
+
+#ifdef __cplusplus
+}
+#endif
+#pragma GCC visibility pop
+
+#endif
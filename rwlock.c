@@ -1,37 +1,300 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
 #include <time.h>
 #include <errno.h>
 #include <pthread.h>
+#include <limits.h>
 #include <assert.h>
 #include "rwlock.h"
+#ifdef RWL_FUTEX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 /* rwl implements a reader-writer lock.
- * A reader-write lock can be acquired in two different modes, 
+ * A reader-write lock can be acquired in two different modes,
  * the "read" (also referred to as "shared") mode,
  * and the "write" (also referred to as "exclusive") mode.
- * Many threads can grab the lock in the "read" mode.  
- * By contrast, if one thread has acquired the lock in "write" mode, no other 
+ * Many threads can grab the lock in the "read" mode.
+ * By contrast, if one thread has acquired the lock in "write" mode, no other
  * threads can acquire the lock in either "read" or "write" mode.
  */
 
-// plan
-// 1. reader - writer lock with no priority
-// just one cond and w_active[0], w_waiting for write count
-// 2. add priority
+/* Everything an uncontended caller needs to look at lives in l->state:
+ *
+ *   bit 0        RWL_WRITER      a writer holds the lock
+ *   bit 1        RWL_R_WAIT      at least one reader is parked
+ *   bit 2        RWL_W_WAIT      at least one writer is parked
+ *   bit 3        RWL_UPGRADER    one of the readers holds it upgradeable
+ *   bits 4..31   reader count, in units of RWL_READER
+ *
+ * Readers and writers try a single CAS on the word first.  When that cannot
+ * succeed they register under l->mutex (bump r_wait/w_wait and set their
+ * waiting bit) and then sleep, without the mutex, on a sequence word.
+ * Which priorities have writers queued is kept in the l->w_mask bitmap,
+ * bit p for priority p, so the highest one is a count-trailing-zeros away
+ * and RWL_W_WAIT is set exactly when the bitmap is non-zero.
+ * Readers use l->r_seq.  A writer queues a struct rwl_waiter in the FIFO for
+ * its priority and sleeps on the node's own grant word.  While writers are
+ * queued, rwl_wunlock and the last rwl_runlock wake only the head of the
+ * highest non-empty queue, and free the lock for it to take: a writer of
+ * that priority or higher arriving meanwhile may barge in first, so a
+ * thread that unlocks and locks again does not queue up behind one that is
+ * not even running yet.  A head that wakes to find the lock taken again
+ * sleeps on, marked as passed over, and the next release hands the lock to
+ * it directly.  RWL_FIFO locks always hand it over, so writers of one
+ * priority get it strictly in arrival order, at the price of a context
+ * switch per contended write when threads outnumber CPUs.  Parked readers
+ * are left alone until no writer is waiting.
+ *
+ * A sleeper reads the sequence word before it checks l->state, and whoever
+ * changes l->state in a way that may let a sleeper in bumps the word
+ * afterwards, so no wakeup is lost and the mutex is never needed to wake
+ * anybody or to go back to sleep.  The waiting bits are only set and
+ * cleared with l->mutex held, so a releaser that sees none of them can
+ * leave without a wakeup at all.
+ */
+#define RWL_WRITER          0x1u
+#define RWL_R_WAIT          0x2u
+#define RWL_W_WAIT          0x4u
+#define RWL_UPGRADER        0x8u
+#define RWL_READER          0x10u
+#define RWL_READER_MASK     (~(RWL_READER - 1))
+#define RWL_LEVEL(p)        (1ull << (p))    // priority p in l->w_mask
+
+/* RWL_BIGREADER locks keep readers out of l->state altogether.  Each CPU
+ * gets its own cache line with a reader counter; a reader bumps the one for
+ * the CPU it runs on and then checks l->state for writers, and a writer
+ * sets RWL_WRITER first and then waits on l->d_seq for the sum of all
+ * counters to reach zero.  A reader may be migrated between lock and
+ * unlock, so single slots can go negative; only the sum means anything.
+ */
+struct rwl_rslot {
+	long                count;
+} __attribute__((aligned(RWL_CACHELINE)));
+
+/* A writer waiting in rwl_wlock.  It lives on the waiter's stack and sits in
+ * l->w_head[p]..l->w_tail[p] while queued; grant is a sequence word bumped
+ * when the waiter is woken for a free lock or handed the lock, popped.  It
+ * is only ever bumped with l->mutex held, so once the waiter has seen under
+ * the mutex that it is no longer queued nobody touches the node again. */
+struct rwl_waiter {
+	struct rwl_waiter  *next;
+	unsigned int        grant;
+	int                 queued;
+	int                 passed;     // woken once and beaten to the lock
+};
+
+/* A write posted by rwl_combine.  It lives on the poster's stack and sits
+ * in l->fc_pub[p], newest first, until a writer holding the lock takes the
+ * whole list, runs it and bumps done, a sequence word, for each entry.
+ * The first poster to find a list empty takes the lock itself afterwards,
+ * so every list has somebody on the way to run it.  Once done is bumped the
+ * node may be gone, so the runner reads next beforehand.  A runner that
+ * stops partway puts the rest back, and if that makes the list anew, adds
+ * one to lead and bumps done to send the oldest poster for the lock
+ * instead; a bump that lead does not account for means the write ran.
+ */
+struct rwl_fcop {
+	struct rwl_fcop    *next;
+	void              (*op)(void *);
+	void               *arg;
+	unsigned int        done;
+	unsigned int        lead;       // times sent to take the lock itself
+};
+
+// most posted writes one unlock runs before letting go
+#define RWL_FC_BATCH        64
+
+static inline unsigned int
+state_load(rwl *l)
+{
+	return __atomic_load_n(&l->state, __ATOMIC_ACQUIRE);
+}
+
+/* Parking.  On Linux waiters sleep on the sequence word itself with a futex.
+ * Elsewhere, or when built with -DRWL_CONDVAR, one condition variable per
+ * lock stands in for the futex queue; every unpark wakes every sleeper and
+ * each rechecks its own word.
+ *
+ * Sequence words count in steps of two.  Bit 0 is RWL_SEQ_SLEEPERS: a
+ * waiter sets it before going to sleep, and rwl_unpark clears it while
+ * bumping the word, so an unpark with nobody asleep is one CAS and no
+ * syscall.
+ */
+#define RWL_SEQ_SLEEPERS    0x1u
+
+/**
+ * @param rwl - lock metadata
+ * @param word - sequence word to sleep on
+ * @param seq - value read from word before checking the lock state
+ * @param abstime - CLOCK_MONOTONIC deadline, or NULL to wait for ever
+ * @return int - ETIMEDOUT if the deadline passed, 0 otherwise
+ * **/
+static int
+rwl_park(rwl *l, unsigned int *word, unsigned int seq,
+    const struct timespec *abstime)
+{
+	unsigned int cur = seq;
+	int rc = 0;
+
+	seq |= RWL_SEQ_SLEEPERS;
+	if (cur != seq && !__atomic_compare_exchange_n(word, &cur, seq, 0,
+	    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) && cur != seq) {
+		// bumped under us; another sleeper setting the bit is fine
+		return 0;
+	}
+#ifdef RWL_FUTEX
+	(void)l;
+	// FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC timeout
+	if (syscall(SYS_futex, word, FUTEX_WAIT_BITSET_PRIVATE, seq, abstime,
+	    NULL, FUTEX_BITSET_MATCH_ANY) != 0 && errno == ETIMEDOUT) {
+		rc = ETIMEDOUT;
+	}
+#else
+	pthread_mutex_lock(&l->park_mutex);
+	while (__atomic_load_n(word, __ATOMIC_ACQUIRE) == seq && rc == 0) {
+		if (abstime != NULL) {
+			rc = pthread_cond_timedwait(&l->park_cond,
+			    &l->park_mutex, abstime);
+		} else {
+			pthread_cond_wait(&l->park_cond, &l->park_mutex);
+		}
+	}
+	pthread_mutex_unlock(&l->park_mutex);
+#endif
+	return rc;
+}
+
+// rwl_unpark bumps a sequence word and wakes everybody sleeping on it
+static void
+rwl_unpark(rwl *l, unsigned int *word)
+{
+	unsigned int seq = __atomic_load_n(word, __ATOMIC_RELAXED);
+
+	while (!__atomic_compare_exchange_n(word, &seq,
+	    (seq + 2) & ~RWL_SEQ_SLEEPERS, 0, __ATOMIC_ACQ_REL,
+	    __ATOMIC_RELAXED)) {
+	}
+	if ((seq & RWL_SEQ_SLEEPERS) == 0) {
+		return;
+	}
+#ifdef RWL_FUTEX
+	(void)l;
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+	pthread_mutex_lock(&l->park_mutex);
+	pthread_cond_broadcast(&l->park_cond);
+	pthread_mutex_unlock(&l->park_mutex);
+#endif
+}
+
+static inline unsigned int
+seq_load(unsigned int *word)
+{
+	return __atomic_load_n(word, __ATOMIC_ACQUIRE);
+}
+
+// queue_push appends w to the writer queue of the given priority
+static void
+queue_push(rwl *l, int priority, struct rwl_waiter *w)
+{
+	w->next = NULL;
+	w->grant = 0;
+	w->queued = 1;
+	w->passed = 0;
+	if (l->w_tail[priority] != NULL) {
+		l->w_tail[priority]->next = w;
+	} else {
+		l->w_head[priority] = w;
+	}
+	l->w_tail[priority] = w;
+	l->w_wait[priority]++;
+	__atomic_fetch_or(&l->w_mask, RWL_LEVEL(priority), __ATOMIC_RELAXED);
+}
+
+// queue_emptied clears the waiting bits for a writer queue that ran dry
+static void
+queue_emptied(rwl *l, int priority)
+{
+	unsigned long long m = __atomic_and_fetch(&l->w_mask,
+	    ~RWL_LEVEL(priority), __ATOMIC_RELAXED);
+	if (m == 0) {
+		__atomic_fetch_and(&l->state, ~RWL_W_WAIT, __ATOMIC_ACQ_REL);
+	}
+}
+
+// queue_pop removes the head of the writer queue of the given priority
+static struct rwl_waiter *
+queue_pop(rwl *l, int priority)
+{
+	struct rwl_waiter *w = l->w_head[priority];
+
+	l->w_head[priority] = w->next;
+	if (l->w_head[priority] == NULL) {
+		l->w_tail[priority] = NULL;
+		queue_emptied(l, priority);
+	}
+	l->w_wait[priority]--;
+	w->queued = 0;
+	return w;
+}
+
+// queue_unlink removes w, which gave up waiting, from anywhere in its queue
+static void
+queue_unlink(rwl *l, int priority, struct rwl_waiter *w)
+{
+	struct rwl_waiter **pp = &l->w_head[priority];
+	struct rwl_waiter *prev = NULL;
+
+	while (*pp != w) {
+		prev = *pp;
+		pp = &prev->next;
+	}
+	*pp = w->next;
+	if (l->w_tail[priority] == w) {
+		l->w_tail[priority] = prev;
+	}
+	if (l->w_head[priority] == NULL) {
+		queue_emptied(l, priority);
+	}
+	l->w_wait[priority]--;
+	w->queued = 0;
+}
+
+/**
+ * @param abstime - deadline passed to one of the timed functions
+ * @return int - 1 if it is not a valid timespec
+ * **/
+static inline int
+bad_deadline(const struct timespec *abstime)
+{
+	return abstime != NULL &&
+	    (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000);
+}
+
+static inline int
+state_cas(rwl *l, unsigned int *expected, unsigned int desired)
+{
+	return __atomic_compare_exchange_n(&l->state, expected, desired, 0,
+	    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
 
 /**
  * @param rwl - lock metadata
  * @return int - the number of active writer
  * **/
 int get_active_writer_count(rwl * l) {
-	if (l->w_active[0] > 0) {
-		assert(l->w_active[0] == 1);
-		return 1;
-	} else if (l->w_active[1] > 0) {
-		assert(l->w_active[1] == 1);
-		return 1;
-	} else if (l->w_active[2] > 0) {
-		assert(l->w_active[2] == 1);
+	if (state_load(l) & RWL_WRITER) {
+		int active = 0;
+		for (int i = 0; i < RWL_LEVELS; i++) {
+			active += l->w_active[i];
+		}
+		assert(active <= 1);
 		return 1;
 	}
 
@@ -39,109 +302,1234 @@ int get_active_writer_count(rwl * l) {
 }
 
 /**
- * @param rwl - lock metadata
+ * @param rwl - lock metadata, with l->mutex held
  * @return int - the index of highest priority of current waiting thread
  * **/
 int get_highest_waiting_writer_priority(rwl * l) {
-	if (l->w_wait[0] > 0) {
-		return 0;
-	} else if (l->w_wait[1] > 0) {
+	unsigned long long m = __atomic_load_n(&l->w_mask, __ATOMIC_RELAXED);
+	return m != 0 ? __builtin_ctzll(m) : -1;
+}
+
+/**
+ * @param rwl - lock metadata
+ * @param priority - priority of the writer asking
+ * @return int - 1 if a writer of a strictly higher priority is waiting
+ * **/
+static inline int
+higher_writer_waiting(rwl *l, int priority)
+{
+	return (__atomic_load_n(&l->w_mask, __ATOMIC_RELAXED) &
+	    (RWL_LEVEL(priority) - 1)) != 0;
+}
+
+/**
+ * @param rwl - lock metadata
+ * @return struct rwl_rslot * - the reader counter of the calling CPU
+ * **/
+static inline struct rwl_rslot *
+br_slot(rwl *l)
+{
+	// glibc serves this from the rseq area, so it does not enter the kernel
+	int cpu = sched_getcpu();
+
+	if (cpu < 0) {
+		cpu = 0;
+	}
+	return &l->r_slots[cpu % l->r_nslots];
+}
+
+/**
+ * @param rwl - lock metadata
+ * @return long - the number of readers inside a RWL_BIGREADER lock
+ * **/
+static long
+br_readers(rwl *l)
+{
+	long sum = 0;
+
+	for (int i = 0; i < l->r_nslots; i++) {
+		sum += __atomic_load_n(&l->r_slots[i].count, __ATOMIC_SEQ_CST);
+	}
+	return sum;
+}
+
+// br_leave drops a RWL_BIGREADER read count, waking a draining writer
+static void
+br_leave(rwl *l, struct rwl_rslot *slot)
+{
+	__atomic_sub_fetch(&slot->count, 1, __ATOMIC_SEQ_CST);
+	if ((__atomic_load_n(&l->state, __ATOMIC_SEQ_CST) & RWL_WRITER) != 0) {
+		rwl_unpark(l, &l->d_seq);
+	}
+}
+
+/**
+ * @param rwl - lock metadata
+ * @return int - 1 if the calling thread is now counted as a reader
+ * **/
+static int
+br_enter(rwl *l)
+{
+	struct rwl_rslot *slot = br_slot(l);
+
+	// pairs with the fence in drain_readers: either we see the writer bit or
+	// the writer sees our count
+	__atomic_add_fetch(&slot->count, 1, __ATOMIC_SEQ_CST);
+	if ((__atomic_load_n(&l->state, __ATOMIC_SEQ_CST) &
+	    (RWL_WRITER | RWL_W_WAIT)) == 0) {
 		return 1;
-	} else if (l->w_wait[2] > 0) {
-		return 2;
 	}
-	return -1;
+	br_leave(l, slot);
+	return 0;
+}
+
+#ifdef RWL_TRACE
+void (*rwl_trace_hook)(rwl *l, int event, int priority);
+#endif
+
+// trace tells rwl_trace_hook about a wait, acquisition or release
+static inline void
+trace(rwl *l, int event, int priority)
+{
+#ifdef RWL_TRACE
+	void (*hook)(rwl *, int, int) = rwl_trace_hook;
+
+	if (hook != NULL) {
+		hook(l, event, priority);
+	}
+#else
+	(void)l;
+	(void)event;
+	(void)priority;
+#endif
+}
+
+/**
+ * drain_readers waits, as the new writer, for readers that were already
+ * inside: those of a RWL_BIGREADER lock, or the ones still sharing the lock
+ * with an upgraded reader
+ * @param rwl - lock metadata
+ * @param priority - the writer's priority, for the trace hook
+ * @param abstime - deadline, or NULL
+ * @return int - ETIMEDOUT if readers were still inside at the deadline
+ * **/
+static int
+drain_readers(rwl *l, int priority, const struct timespec *abstime)
+{
+	int waited = 0;
+	int rc = 0;
+
+	for (;;) {
+		unsigned int seq = seq_load(&l->d_seq);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if ((state_load(l) & RWL_READER_MASK) == 0 &&
+		    ((l->flags & RWL_BIGREADER) == 0 || br_readers(l) == 0)) {
+			return 0;
+		}
+		if (rc == ETIMEDOUT) {
+			return rc;
+		}
+		if (!waited) {
+			trace(l, RWL_TRACE_WAIT, priority);
+			waited = 1;
+		}
+		rc = rwl_park(l, &l->d_seq, seq, abstime);
+	}
+}
+
+//rwl_attr_init fills attr with the defaults used by rwl_init
+void
+rwl_attr_init(rwl_attr *attr)
+{
+	attr->flags = 0;
+}
+
+/* RWL_ADAPTIVE locks spin a little before parking.  The budget is learned
+ * per lock: l->spin tracks, as a moving average, how many rounds of
+ * cpu_relax() it took for the lock to come free when spinning paid off and
+ * decays towards zero when it did not, so short critical sections earn a
+ * spin a bit longer than they usually last and long ones end up with a
+ * token RWL_SPIN_MIN rounds.  Spinning stops early once a writer is queued
+ * (the lock will be handed over, not released) or when the writer holding
+ * the lock last ran on our CPU, since it cannot be running while we are.
+ * l->spin counts eighths of a round, and every step rounds, so that short
+ * spins still move the average and failures take it all the way down.
+ */
+#define RWL_SPIN_MIN        16u
+#define RWL_SPIN_MAX        256u
+#define RWL_SPIN_SHIFT      3       // l->spin is the average << this
+
+static inline void
+cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/* Optimistic readers (rwl_oread_begin in rwlock.h) never touch the lock;
+ * they only compare l->seq before and after.  A writer makes it odd once
+ * it has the lock to itself and even again before letting go, with the
+ * fences a seqlock needs around its own stores.
+ */
+static inline void
+seq_enter(rwl *l)
+{
+	__atomic_store_n(&l->seq, l->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void
+seq_leave(rwl *l)
+{
+	__atomic_store_n(&l->seq, l->seq + 1, __ATOMIC_RELEASE);
+}
+
+// note_owner records where a RWL_ADAPTIVE writer took the lock
+static inline void
+note_owner(rwl *l)
+{
+	if (l->flags & RWL_ADAPTIVE) {
+		__atomic_store_n(&l->w_cpu, sched_getcpu(), __ATOMIC_RELAXED);
+	}
+}
+
+/* RWL_STATS locks count into a struct rwl_sslot per CPU, with relaxed
+ * atomics since a thread may be migrated halfway through an update, and
+ * rwl_stats_get adds the slots up.  A writer's hold starts at l->w_since;
+ * a reader's is kept in the r_held stack of its thread, which only has
+ * room for the RWL_STATS_NEST innermost read locks.
+ */
+#define RWL_STATS_NEST      8
+
+struct rwl_sslot {
+	rwl_stats           s;
+} __attribute__((aligned(RWL_CACHELINE)));
+
+static __thread struct {
+	rwl                *l;
+	unsigned long long  since;
+} r_held[RWL_STATS_NEST];
+static __thread int r_nheld;
+
+static inline unsigned long long
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @param rwl - lock metadata
+ * @return unsigned long long - the time, if l keeps statistics, or 0
+ * **/
+static inline unsigned long long
+stats_clock(rwl *l)
+{
+	return l->stats != NULL ? now_ns() : 0;
+}
+
+/**
+ * @param rwl - lock metadata, with RWL_STATS
+ * @param priority - writer priority, or -1 for readers
+ * @return rwl_stat * - the counters of the calling CPU
+ * **/
+static rwl_stat *
+stats_of(rwl *l, int priority)
+{
+	int cpu = sched_getcpu();
+	struct rwl_sslot *slot = &l->stats[(cpu < 0 ? 0 : cpu) % l->s_nslots];
+
+	return priority < 0 ? &slot->s.read : &slot->s.write[priority];
+}
+
+static inline void
+stats_add(unsigned long long *counter, unsigned long long n)
+{
+	__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static inline void
+stats_max(unsigned long long *counter, unsigned long long n)
+{
+	unsigned long long cur = __atomic_load_n(counter, __ATOMIC_RELAXED);
+
+	while (n > cur && !__atomic_compare_exchange_n(counter, &cur, n, 0,
+	    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+/**
+ * stats_acquired counts an acquisition and starts timing the hold; it is
+ * also where the trace hook hears of it
+ * @param rwl - lock metadata
+ * @param priority - writer priority, or -1 for readers
+ * @param since - stats_clock() from before the caller started waiting, or
+ * 0 if it got in without waiting
+ * **/
+static inline void
+stats_acquired(rwl *l, int priority, unsigned long long since)
+{
+	trace(l, RWL_TRACE_ACQUIRE, priority);
+	if (l->stats == NULL) {
+		return;
+	}
+	rwl_stat *st = stats_of(l, priority);
+	unsigned long long now = now_ns();
+
+	stats_add(&st->acquired, 1);
+	if (since != 0) {
+		stats_add(&st->contended, 1);
+		stats_add(&st->wait_ns, now - since);
+		stats_max(&st->wait_max_ns, now - since);
+	}
+	if (priority >= 0) {
+		l->w_since = now;
+	} else if (r_nheld < RWL_STATS_NEST) {
+		r_held[r_nheld].l = l;
+		r_held[r_nheld++].since = now;
+	}
+}
+
+/**
+ * stats_released adds the hold that is ending to the hold time, and tells
+ * the trace hook
+ * @param rwl - lock metadata
+ * @param priority - writer priority, or -1 for readers
+ * **/
+static inline void
+stats_released(rwl *l, int priority)
+{
+	trace(l, RWL_TRACE_RELEASE, priority);
+	if (l->stats == NULL) {
+		return;
+	}
+	unsigned long long since = 0;
+
+	if (priority >= 0) {
+		since = l->w_since;
+	} else {
+		for (int i = r_nheld - 1; i >= 0; i--) {
+			if (r_held[i].l == l) {
+				since = r_held[i].since;
+				r_held[i] = r_held[--r_nheld];
+				break;
+			}
+		}
+		if (since == 0) {
+			// taken with the stack full
+			return;
+		}
+	}
+	rwl_stat *st = stats_of(l, priority);
+	unsigned long long held = now_ns() - since;
+	stats_add(&st->hold_ns, held);
+	stats_max(&st->hold_max_ns, held);
+}
+
+// stats_spurious counts a wakeup after which the lock was still busy
+static inline void
+stats_spurious(rwl *l, int priority)
+{
+	if (l->stats != NULL) {
+		stats_add(&stats_of(l, priority)->spurious, 1);
+	}
+}
+
+/**
+ * @param rwl - lock metadata
+ * @param busy - l->state bits that keep the caller out
+ * @return unsigned int - the last snapshot of l->state
+ * **/
+static unsigned int
+adaptive_spin(rwl *l, unsigned int busy)
+{
+	unsigned int s = state_load(l);
+	unsigned int old = __atomic_load_n(&l->spin, __ATOMIC_RELAXED);
+	unsigned int est = old;
+	unsigned int half = 1u << (RWL_SPIN_SHIFT - 1);
+	unsigned int limit = ((est + half) >> RWL_SPIN_SHIFT) * 2 + RWL_SPIN_MIN;
+	unsigned int n;
+	int cpu = sched_getcpu();
+
+	if (limit > RWL_SPIN_MAX) {
+		limit = RWL_SPIN_MAX;
+	}
+	for (n = 0; n < limit && (s & busy) != 0; n++) {
+		if ((s & RWL_W_WAIT) != 0 || ((s & RWL_WRITER) &&
+		    __atomic_load_n(&l->w_cpu, __ATOMIC_RELAXED) == cpu)) {
+			break;
+		}
+		cpu_relax();
+		s = state_load(l);
+	}
+	// racy on purpose, a lost update only costs a little accuracy; once
+	// the estimate settles, spinners stop dirtying the line
+	// est += (n - est) / 8, in fixed point: rounded to nearest on
+	// success, and up on failure so that it reaches 0
+	if ((s & busy) == 0) {
+		est = est - ((est + half) >> RWL_SPIN_SHIFT) + n;
+	} else {
+		est -= (est + (1u << RWL_SPIN_SHIFT) - 1) >> RWL_SPIN_SHIFT;
+	}
+	if (est != old) {
+		__atomic_store_n(&l->spin, est, __ATOMIC_RELAXED);
+	}
+	return s;
 }
 
-//rwl_init initializes the reader-writer lock 
+/**
+ * @param rwl - lock metadata
+ * @param s - a snapshot of l->state
+ * @param priority - priority of the writer asking
+ * @return int - 1 if a writer of that priority has to wait
+ * **/
+static inline int
+writer_blocked(rwl *l, unsigned int s, int priority)
+{
+	return (s & (RWL_READER_MASK | RWL_WRITER)) != 0 ||
+	    higher_writer_waiting(l, priority);
+}
+
+//rwl_init initializes the reader-writer lock
 void
 rwl_init(rwl *l)
 {
+	int rc = rwl_init_attr(l, NULL);
+	assert(rc == 0);
+}
+
+/* Flags every lock gets on top of those it asks for.  The stats build of
+ * the library sets RWL_STATS here, so an application's locks all keep
+ * statistics without a code change. */
+#ifndef RWL_FORCE_FLAGS
+#define RWL_FORCE_FLAGS     0
+#endif
+
+//rwl_init_attr initializes the reader-writer lock with the given mode
+int
+rwl_init_attr(rwl *l, const rwl_attr *attr)
+{
+	// phase-fair grants add to the reader count in l->state, which big
+	// readers do not use
+	if (attr != NULL && (attr->flags & RWL_PHASE_FAIR) &&
+	    (attr->flags & RWL_BIGREADER)) {
+		return EINVAL;
+	}
+
 	// initialization of read/write lock
 	int rc = pthread_mutex_init(&l->mutex, NULL);
 	assert(rc == 0);
-	rc = pthread_cond_init(&l->r_cond, NULL);
+#ifndef RWL_FUTEX
+	pthread_condattr_t ca;
+	rc = pthread_mutex_init(&l->park_mutex, NULL);
+	assert(rc == 0);
+	pthread_condattr_init(&ca);
+	pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+	rc = pthread_cond_init(&l->park_cond, &ca);
 	assert(rc == 0);
-	l->r_active = 0;
+	pthread_condattr_destroy(&ca);
+#endif
+	l->state = 0;
+	l->r_seq = 0;
+	l->d_seq = 0;
+	l->flags = (attr != NULL ? attr->flags : 0) | RWL_FORCE_FLAGS;
+	l->r_slots = NULL;
+	l->r_nslots = 0;
+	l->stats = NULL;
+	l->s_nslots = 0;
+	l->w_since = 0;
 	l->r_wait = 0;
+	l->r_queued = 0;
+	l->r_phase = 0;
+	l->spin = 0;
+	l->seq = 0;
+	l->w_cpu = -1;
 
-	for (size_t i = 0; i < 3; i++) {
-		rc = pthread_cond_init(&l->w_cond[i], NULL);
-		assert(rc == 0);
+	l->w_mask = 0;
+	l->fc_mask = 0;
+	for (size_t i = 0; i < RWL_LEVELS; i++) {
+		l->fc_pub[i] = NULL;
+		l->w_head[i] = NULL;
+		l->w_tail[i] = NULL;
 		l->w_active[i] = 0;
 		l->w_wait[i] = 0;
 	}
+
+	if (l->flags & RWL_BIGREADER) {
+		long n = sysconf(_SC_NPROCESSORS_CONF);
+		if (n < 1) {
+			n = 1;
+		}
+		l->r_slots = aligned_alloc(RWL_CACHELINE,
+		    n * sizeof(struct rwl_rslot));
+		if (l->r_slots == NULL) {
+			rwl_destroy(l);
+			return ENOMEM;
+		}
+		for (long i = 0; i < n; i++) {
+			l->r_slots[i].count = 0;
+		}
+		l->r_nslots = (int)n;
+	}
+	if (l->flags & RWL_STATS) {
+		long n = sysconf(_SC_NPROCESSORS_CONF);
+		if (n < 1) {
+			n = 1;
+		}
+		l->stats = aligned_alloc(RWL_CACHELINE,
+		    n * sizeof(struct rwl_sslot));
+		if (l->stats == NULL) {
+			rwl_destroy(l);
+			return ENOMEM;
+		}
+		memset(l->stats, 0, n * sizeof(struct rwl_sslot));
+		l->s_nslots = (int)n;
+	}
+	return 0;
 }
 
-//rwl_rlock attempts to grab the lock in "read" mode
+//rwl_destroy releases what rwl_init_attr allocated; the lock must be idle
 void
-rwl_rlock(rwl *l)
+rwl_destroy(rwl *l)
+{
+	pthread_mutex_destroy(&l->mutex);
+#ifndef RWL_FUTEX
+	pthread_mutex_destroy(&l->park_mutex);
+	pthread_cond_destroy(&l->park_cond);
+#endif
+	free(l->r_slots);
+	l->r_slots = NULL;
+	free(l->stats);
+	l->stats = NULL;
+}
+
+/**
+ * @param from - counters of one CPU
+ * @param to - running total
+ * **/
+static void
+stats_sum(rwl_stat *from, rwl_stat *to)
+{
+	to->acquired += __atomic_load_n(&from->acquired, __ATOMIC_RELAXED);
+	to->contended += __atomic_load_n(&from->contended, __ATOMIC_RELAXED);
+	to->wait_ns += __atomic_load_n(&from->wait_ns, __ATOMIC_RELAXED);
+	to->hold_ns += __atomic_load_n(&from->hold_ns, __ATOMIC_RELAXED);
+	to->spurious += __atomic_load_n(&from->spurious, __ATOMIC_RELAXED);
+	unsigned long long m = __atomic_load_n(&from->wait_max_ns,
+	    __ATOMIC_RELAXED);
+	if (m > to->wait_max_ns) {
+		to->wait_max_ns = m;
+	}
+	m = __atomic_load_n(&from->hold_max_ns, __ATOMIC_RELAXED);
+	if (m > to->hold_max_ns) {
+		to->hold_max_ns = m;
+	}
+}
+
+//rwl_stats_get fills stats in with the counters of a RWL_STATS lock
+int
+rwl_stats_get(rwl *l, rwl_stats *stats)
+{
+	if (l->stats == NULL) {
+		return EINVAL;
+	}
+	memset(stats, 0, sizeof(*stats));
+	for (int i = 0; i < l->s_nslots; i++) {
+		stats_sum(&l->stats[i].s.read, &stats->read);
+		for (int p = 0; p < RWL_LEVELS; p++) {
+			stats_sum(&l->stats[i].s.write[p], &stats->write[p]);
+		}
+	}
+	return 0;
+}
+
+/* RWL_PHASE_FAIR locks alternate between read and write phases.  New
+ * readers still wait while a writer holds the lock or is queued, but a
+ * writer on its way out lets in every plain reader that queued up behind
+ * it, in one go, before the next queued writer gets a turn; the last of
+ * those readers then hands the lock on to that writer.  Readers register
+ * in l->r_queued together with the l->r_phase they saw, and pf_admit bumps
+ * r_phase once it has added them all to the reader count.  So no reader
+ * waits for more than one write phase and one read phase, and writers
+ * still go in priority order among themselves.
+ */
+
+/**
+ * @param rwl - lock metadata, with l->mutex held and RWL_WRITER set
+ * @param extra - read counts the caller adds for itself, see rwl_wdowngrade
+ * @return int - 1 if queued readers were let in and RWL_WRITER dropped
+ * **/
+static int
+pf_admit(rwl *l, unsigned int extra)
+{
+	unsigned int s = state_load(l);
+
+	if (l->r_queued == 0) {
+		return 0;
+	}
+	while (!state_cas(l, &s,
+	    (s & ~RWL_WRITER) + (l->r_queued + extra) * RWL_READER)) {
+	}
+	l->r_queued = 0;
+	__atomic_store_n(&l->r_phase, l->r_phase + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+// pf_admitted tells a parked RWL_PHASE_FAIR reader it was let in
+static inline int
+pf_admitted(rwl *l, int pf, unsigned int phase)
+{
+	return pf && __atomic_load_n(&l->r_phase, __ATOMIC_ACQUIRE) != phase;
+}
+
+/**
+ * pass_writer lets the head of the highest writer queue have the lock.  A
+ * head that was passed over before, or any head of a RWL_FIFO lock, is
+ * handed it outright; any other one is woken with the lock freed, to take
+ * it unless a barger is quicker.
+ * @param rwl - lock metadata, with l->mutex and RWL_WRITER held and
+ *              RWL_W_WAIT set
+ * **/
+static void
+pass_writer(rwl *l)
+{
+	int p = get_highest_waiting_writer_priority(l);
+	struct rwl_waiter *w = l->w_head[p];
+
+	if (w->passed || (l->flags & RWL_FIFO)) {
+		queue_pop(l, p);
+	} else {
+		__atomic_fetch_and(&l->state, ~RWL_WRITER, __ATOMIC_RELEASE);
+	}
+	rwl_unpark(l, &w->grant);
+}
+
+/**
+ * write_barge takes a free lock ahead of queued writers of the same or a
+ * lower priority, which are at most woken and not yet inside
+ * @param rwl - lock metadata
+ * @param s - a recent snapshot of l->state
+ * @param priority - priority of the writer asking
+ * @return int - 1 if the lock was taken in "write" mode
+ * **/
+static int
+write_barge(rwl *l, unsigned int s, int priority)
+{
+	if ((l->flags & RWL_FIFO) && (s & RWL_W_WAIT)) {
+		return 0;
+	}
+	while ((s & (RWL_READER_MASK | RWL_WRITER)) == 0 &&
+	    !higher_writer_waiting(l, priority)) {
+		if (state_cas(l, &s, s | RWL_WRITER)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @param rwl - lock metadata
+ * @param take - RWL_UPGRADER for an upgradeable read, 0 for a plain one
+ * @return int - 1 if the lock was taken in "read" mode without waiting
+ * **/
+static int
+read_trylock(rwl *l, unsigned int take)
+{
+	unsigned int busy = RWL_WRITER | RWL_W_WAIT | take;
+	unsigned int s = state_load(l);
+
+	// no writer active or waiting, just bump the reader count; the
+	// upgradeable reader is counted in l->state even on big-reader locks
+	if ((l->flags & RWL_BIGREADER) && take == 0) {
+		return (s & busy) == 0 && br_enter(l);
+	}
+	while ((s & busy) == 0) {
+		if (state_cas(l, &s, s + RWL_READER + take)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @param rwl - lock metadata
+ * @param take - RWL_UPGRADER for an upgradeable read, 0 for a plain one
+ * @param abstime - deadline, or NULL to wait for ever
+ * @return int - 0 with the lock held in "read" mode, ETIMEDOUT or EINVAL
+ * **/
+static int
+read_lock(rwl *l, unsigned int take, const struct timespec *abstime)
 {
+	unsigned int busy = RWL_WRITER | RWL_W_WAIT | take;
+	int pf = (l->flags & RWL_PHASE_FAIR) && take == 0;
+	unsigned int phase = 0;
+	unsigned long long since;
+	unsigned int s;
+	int woken = 0;
+	int rc = 0;
+
+	if (read_trylock(l, take)) {
+		stats_acquired(l, -1, 0);
+		return 0;
+	}
+	if (bad_deadline(abstime)) {
+		return EINVAL;
+	}
+	since = stats_clock(l);
+	if (l->flags & RWL_ADAPTIVE) {
+		adaptive_spin(l, RWL_WRITER | take);
+		if (read_trylock(l, take)) {
+			stats_acquired(l, -1, since);
+			return 0;
+		}
+	}
+
 	pthread_mutex_lock(&l->mutex);
 	l->r_wait++;
-	while ((get_active_writer_count(l)) != 0 ||  get_highest_waiting_writer_priority(l) != -1) {
-		pthread_cond_wait(&l->r_cond, &l->mutex);
+	__atomic_fetch_or(&l->state, RWL_R_WAIT, __ATOMIC_ACQ_REL);
+	if (pf) {
+		phase = l->r_phase;
+		l->r_queued++;
 	}
-	l->r_wait--;
+	for (;;) {
+		s = state_load(l);
+		if (pf && l->r_phase != phase) {
+			// a writer on its way out has counted us in already
+			rc = 0;
+			pf = 0;
+			break;
+		}
+		if ((s & busy) == 0) {
+			if ((l->flags & RWL_BIGREADER) && take == 0 ?
+			    br_enter(l) : state_cas(l, &s, s + RWL_READER + take)) {
+				rc = 0;
+				break;
+			}
+			continue;
+		}
+		if (rc == ETIMEDOUT) {
+			break;
+		}
 
-	l->r_active++;
+		// sleep without the mutex; only come back for it once the
+		// lock looks free, spurious wakeups just go back to sleep
+		pthread_mutex_unlock(&l->mutex);
+		if (!woken) {
+			trace(l, RWL_TRACE_WAIT, -1);
+		}
+		do {
+			unsigned int seq = seq_load(&l->r_seq);
+			s = state_load(l);
+			if ((s & busy) != 0 && !pf_admitted(l, pf, phase)) {
+				if (woken) {
+					stats_spurious(l, -1);
+				}
+				rc = rwl_park(l, &l->r_seq, seq, abstime);
+				woken = 1;
+			}
+		} while ((s & busy) != 0 && !pf_admitted(l, pf, phase) &&
+		    rc == 0);
+		pthread_mutex_lock(&l->mutex);
+	}
+	if (pf) {
+		l->r_queued--;
+	}
+	// a parked reader holds nobody up, so giving up needs no wakeups
+	if (--l->r_wait == 0) {
+		__atomic_fetch_and(&l->state, ~RWL_R_WAIT, __ATOMIC_ACQ_REL);
+	}
 	pthread_mutex_unlock(&l->mutex);
+	if (rc == 0) {
+		stats_acquired(l, -1, since);
+	}
+	return rc;
+}
+
+//rwl_rlock attempts to grab the lock in "read" mode
+void
+rwl_rlock(rwl *l)
+{
+	read_lock(l, 0, NULL);
+}
+
+//rwl_tryrlock grabs the lock in "read" mode if that needs no waiting
+int
+rwl_tryrlock(rwl *l)
+{
+	if (!read_trylock(l, 0)) {
+		return EBUSY;
+	}
+	stats_acquired(l, -1, 0);
+	return 0;
 }
 
+//rwl_timedrlock is rwl_rlock giving up at a CLOCK_MONOTONIC deadline
+int
+rwl_timedrlock(rwl *l, const struct timespec *abstime)
+{
+	return read_lock(l, 0, abstime);
+}
+
+/**
+ * read_release finishes dropping a read count kept in l->state
+ * @param rwl - lock metadata
+ * @param s - l->state right after the count was dropped
+ * **/
+static void
+read_release(rwl *l, unsigned int s)
+{
+	if ((s & RWL_READER_MASK) != 0) {
+		return;
+	}
+	// an upgraded reader waits for us to leave
+	if (s & RWL_WRITER) {
+		rwl_unpark(l, &l->d_seq);
+		return;
+	}
+
+	// the last reader out passes the lock on to the next writer
+	if ((s & RWL_W_WAIT) != 0) {
+		pthread_mutex_lock(&l->mutex);
+		s = state_load(l);
+		while ((s & (RWL_READER_MASK | RWL_WRITER)) == 0 &&
+		    (s & RWL_W_WAIT) != 0) {
+			if (state_cas(l, &s, s | RWL_WRITER)) {
+				pass_writer(l);
+				break;
+			}
+		}
+		pthread_mutex_unlock(&l->mutex);
+	}
+}
 
 //rwl_runlock unlocks the lock held in the "read" mode
 void
 rwl_runlock(rwl *l)
 {
-	int index = 0;
+	stats_released(l, -1);
+	if (l->flags & RWL_BIGREADER) {
+		br_leave(l, br_slot(l));
+		return;
+	}
+	read_release(l, __atomic_sub_fetch(&l->state, RWL_READER,
+	    __ATOMIC_ACQ_REL));
+}
+
+//rwl_ulock grabs the lock in "read" mode, with the right to upgrade it
+void
+rwl_ulock(rwl *l)
+{
+	read_lock(l, RWL_UPGRADER, NULL);
+}
+
+//rwl_uunlock unlocks the lock held by rwl_ulock without upgrading it
+void
+rwl_uunlock(rwl *l)
+{
+	unsigned int s;
+
+	assert(state_load(l) & RWL_UPGRADER);
+	stats_released(l, -1);
+	s = __atomic_sub_fetch(&l->state, RWL_READER + RWL_UPGRADER,
+	    __ATOMIC_ACQ_REL);
+	// the next rwl_ulock caller may be parked with the readers
+	if ((s & RWL_R_WAIT) && (s & (RWL_WRITER | RWL_W_WAIT)) == 0) {
+		rwl_unpark(l, &l->r_seq);
+	}
+	read_release(l, s);
+}
+
+/**
+ * rwl_uupgrade turns the hold taken by rwl_ulock into a "write" hold.  The
+ * lock is never released in between; readers already inside are waited
+ * out, and queued writers, which cannot get in before we leave anyway, stay
+ * queued.
+ * @param rwl - lock metadata
+ * @param priority - priority to hold the lock at, as for rwl_wlock
+ * **/
+void
+rwl_uupgrade(rwl *l, int priority)
+{
+	unsigned int s = state_load(l);
+
+	assert(priority >= 0 && priority < RWL_LEVELS);
+	assert(s & RWL_UPGRADER);
+	stats_released(l, -1);
+	// while we are counted no writer can set RWL_WRITER, so this only
+	// retries on concurrent reader traffic
+	while (!state_cas(l, &s,
+	    ((s - RWL_READER) & ~RWL_UPGRADER) | RWL_WRITER)) {
+	}
+	l->w_active[priority]++;
+	note_owner(l);
+	drain_readers(l, priority, NULL);
+	stats_acquired(l, priority, 0);
+	seq_enter(l);
+}
+
+static void write_release(rwl *l);
+
+/**
+ * @param rwl - lock metadata
+ * @param priority - writer priority, 0 is the highest
+ * @param abstime - deadline, or NULL to wait for ever
+ * @return int - 0 with the lock held in "write" mode, ETIMEDOUT or EINVAL
+ * **/
+static int
+write_lock(rwl *l, int priority, const struct timespec *abstime)
+{
+	unsigned int s = 0;
+	unsigned int seq = 0;
+	struct rwl_waiter self;
+	unsigned long long since = 0;
+	int waited = 0;
+	int rc = 0;
+
+	assert(priority >= 0 && priority < RWL_LEVELS);
+	if (bad_deadline(abstime)) {
+		return EINVAL;
+	}
+	// fast path: nobody holds the lock or is queued ahead of us
+	if (state_cas(l, &s, RWL_WRITER) || write_barge(l, s, priority)) {
+		goto acquired;
+	}
+	since = stats_clock(l);
+	if (l->flags & RWL_ADAPTIVE) {
+		s = adaptive_spin(l, RWL_READER_MASK | RWL_WRITER);
+		if (write_barge(l, s, priority)) {
+			goto acquired;
+		}
+	}
+
 	pthread_mutex_lock(&l->mutex);
-	l->r_active--;
-	if (l->r_active == 0) {
-		pthread_cond_broadcast(&l->r_cond);
+	queue_push(l, priority, &self);
+	__atomic_fetch_or(&l->state, RWL_W_WAIT, __ATOMIC_ACQ_REL);
+	// whoever frees the lock either hands it to us, dequeued, or wakes us
+	// to take it while we are first in line
+	for (;;) {
+		if (!self.queued) {
+			break;
+		}
+		s = state_load(l);
+		if (l->w_head[priority] == &self &&
+		    !writer_blocked(l, s, priority)) {
+			if (state_cas(l, &s, s | RWL_WRITER)) {
+				queue_pop(l, priority);
+				break;
+			}
+			continue;
+		}
+		if (waited && (seq_load(&self.grant) | RWL_SEQ_SLEEPERS) !=
+		    (seq | RWL_SEQ_SLEEPERS)) {
+			// woken for a free lock that somebody else got first
+			self.passed = 1;
+			stats_spurious(l, priority);
+		}
+		if (rc == ETIMEDOUT) {
+			queue_unlink(l, priority, &self);
+			// a free lock we were woken for goes to the next writer;
+			// with none left, we may have been the last one keeping
+			// readers out
+			s = state_load(l);
+			while ((s & (RWL_READER_MASK | RWL_WRITER)) == 0 &&
+			    (s & RWL_W_WAIT) != 0) {
+				if (state_cas(l, &s, s | RWL_WRITER)) {
+					pass_writer(l);
+					break;
+				}
+			}
+			s = state_load(l);
+			pthread_mutex_unlock(&l->mutex);
+			if ((s & (RWL_WRITER | RWL_W_WAIT)) == 0 &&
+			    (s & RWL_R_WAIT) != 0) {
+				rwl_unpark(l, &l->r_seq);
+			}
+			return ETIMEDOUT;
+		}
+
+		seq = seq_load(&self.grant);
+		pthread_mutex_unlock(&l->mutex);
+		if (!waited) {
+			trace(l, RWL_TRACE_WAIT, priority);
+			waited = 1;
+		}
+		rc = rwl_park(l, &self.grant, seq, abstime);
+		pthread_mutex_lock(&l->mutex);
 	}
 	pthread_mutex_unlock(&l->mutex);
-}
 
+acquired:
+	l->w_active[priority]++;
+	note_owner(l);
+
+	// RWL_BIGREADER readers do not show up in l->state, wait them out now
+	if ((l->flags & RWL_BIGREADER) &&
+	    drain_readers(l, priority, abstime) != 0) {
+		l->w_active[priority]--;
+		write_release(l);
+		return ETIMEDOUT;
+	}
+	stats_acquired(l, priority, since);
+	seq_enter(l);
+	return 0;
+}
 
 //rwl_wlock attempts to grab the lock in "write" mode
 void
 rwl_wlock(rwl *l, int priority)
 {
+	write_lock(l, priority, NULL);
+}
+
+//rwl_timedwlock is rwl_wlock giving up at a CLOCK_MONOTONIC deadline
+int
+rwl_timedwlock(rwl *l, int priority, const struct timespec *abstime)
+{
+	return write_lock(l, priority, abstime);
+}
+
+// write_release gives up RWL_WRITER, passing it on to a queued writer
+static void
+write_release(rwl *l)
+{
+	// fast path: no writer is queued, so just drop the writer bit; a
+	// phase-fair lock with readers parked has to admit them under the
+	// mutex, or a writer re-locking in a loop would keep them out for ever
+	unsigned int s = state_load(l);
+	while ((s & RWL_W_WAIT) == 0 &&
+	    !((l->flags & RWL_PHASE_FAIR) && (s & RWL_R_WAIT))) {
+		if (state_cas(l, &s, s & ~RWL_WRITER)) {
+			if (s & RWL_R_WAIT) {
+				rwl_unpark(l, &l->r_seq);
+			}
+			return;
+		}
+	}
+
 	pthread_mutex_lock(&l->mutex);
+	if ((l->flags & RWL_PHASE_FAIR) && pf_admit(l, 0)) {
+		pthread_mutex_unlock(&l->mutex);
+		rwl_unpark(l, &l->r_seq);
+		return;
+	}
 
-	l->w_wait[priority]++;
-	while (l->r_active > 0) {
-		pthread_cond_wait(&l->r_cond, &l->mutex);
+	// pass the lock on to the first writer of the highest priority
+	if (get_highest_waiting_writer_priority(l) != -1) {
+		pass_writer(l);
+		pthread_mutex_unlock(&l->mutex);
+		return;
 	}
-	while ((get_active_writer_count(l)) != 0) {
-		pthread_cond_wait(&l->w_cond[priority], &l->mutex);
+	s = __atomic_fetch_and(&l->state, ~RWL_WRITER, __ATOMIC_ACQ_REL);
+	pthread_mutex_unlock(&l->mutex);
+	if (s & RWL_R_WAIT) {
+		rwl_unpark(l, &l->r_seq);
+	}
+}
+
+//rwl_trywlock grabs the lock in "write" mode if that needs no waiting
+int
+rwl_trywlock(rwl *l, int priority)
+{
+	unsigned int s = state_load(l);
+
+	assert(priority >= 0 && priority < RWL_LEVELS);
+	// queued writers of lower priority do not stop us, anything else does
+	while ((s & (RWL_READER_MASK | RWL_WRITER)) == 0 &&
+	    ((s & RWL_W_WAIT) == 0 || (__atomic_load_n(&l->w_mask,
+	    __ATOMIC_RELAXED) & ((RWL_LEVEL(priority) << 1) - 1)) == 0)) {
+		if (!state_cas(l, &s, s | RWL_WRITER)) {
+			continue;
+		}
+		if (l->flags & RWL_BIGREADER) {
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			if (br_readers(l) != 0) {
+				write_release(l);
+				return EBUSY;
+			}
+		}
+		l->w_active[priority]++;
+		note_owner(l);
+		stats_acquired(l, priority, 0);
+		seq_enter(l);
+		return 0;
 	}
-	while (priority > 0 && l->w_wait[0] > 0) {
-		pthread_cond_wait(&l->w_cond[priority], &l->mutex);
+	return EBUSY;
+}
+
+/**
+ * rwl_wdowngrade turns a "write" hold into a "read" hold without letting go
+ * of the lock.  Waiting readers join us; queued writers stay queued and get
+ * the lock from the last reader out, as usual.
+ * @param rwl - lock metadata
+ * @param priority - priority the lock was taken at
+ * **/
+void
+rwl_wdowngrade(rwl *l, int priority)
+{
+	unsigned int s;
+
+	assert(l->w_active[priority] == 1);
+	stats_released(l, priority);
+	l->w_active[priority]--;
+	seq_leave(l);
+	stats_acquired(l, -1, 0);
+	if (l->flags & RWL_BIGREADER) {
+		// big readers are invisible to queued writers, so one of them
+		// has to take RWL_WRITER over now and wait for us in
+		// drain_readers
+		__atomic_add_fetch(&br_slot(l)->count, 1, __ATOMIC_SEQ_CST);
+		write_release(l);
+		return;
 	}
-	while (priority > 1 && l->w_wait[1] > 0) {
-		pthread_cond_wait(&l->w_cond[priority], &l->mutex);
+
+	if (l->flags & RWL_PHASE_FAIR) {
+		// the read phase starts now, with us in it
+		pthread_mutex_lock(&l->mutex);
+		int admitted = pf_admit(l, 1);
+		pthread_mutex_unlock(&l->mutex);
+		if (admitted) {
+			rwl_unpark(l, &l->r_seq);
+			return;
+		}
 	}
-	l->w_wait[priority]--;
 
-	l->w_active[priority]++;
-	pthread_mutex_unlock(&l->mutex);	
+	s = state_load(l);
+	while (!state_cas(l, &s, (s & ~RWL_WRITER) + RWL_READER)) {
+	}
+	if ((s & RWL_R_WAIT) && (s & RWL_W_WAIT) == 0) {
+		rwl_unpark(l, &l->r_seq);
+	}
+}
+
+/**
+ * fc_defer puts posted writes fc_run had no time for back in l->fc_pub[p],
+ * behind any posted since, so that they still run first
+ * @param rwl - lock metadata, with the lock held in "write" mode
+ * @param p - their priority
+ * @param list - the writes, oldest first
+ * **/
+static void
+fc_defer(rwl *l, int p, struct rwl_fcop *list)
+{
+	struct rwl_fcop *oldest = list, *chain = NULL, *head = NULL, *o;
+
+	while (list != NULL) {
+		o = list;
+		list = o->next;
+		o->next = chain;
+		chain = o;
+	}
+	// only lock holders follow next, so the tail of a list is ours to
+	// extend while posters push at its head
+	if (!__atomic_compare_exchange_n(&l->fc_pub[p], &head, chain, 0,
+	    __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+		for (o = head; o->next != NULL; o = o->next) {
+		}
+		o->next = chain;
+	}
+	__atomic_fetch_or(&l->fc_mask, RWL_LEVEL(p), __ATOMIC_SEQ_CST);
+	// the list was empty, so nobody is on the way to run it
+	if (head == NULL) {
+		__atomic_add_fetch(&oldest->lead, 1, __ATOMIC_RELAXED);
+		rwl_unpark(l, &oldest->done);
+	}
+}
+
+/**
+ * fc_run runs writes posted with rwl_combine, highest priority first and
+ * oldest first within one, until none are left or RWL_FC_BATCH have run
+ * @param rwl - lock metadata, with the lock held in "write" mode
+ * **/
+static void
+fc_run(rwl *l)
+{
+	unsigned long long m;
+	int ran = 0;
+
+	while (ran < RWL_FC_BATCH &&
+	    (m = __atomic_load_n(&l->fc_mask, __ATOMIC_ACQUIRE)) != 0) {
+		int p = __builtin_ctzll(m);
+		struct rwl_fcop *list = NULL, *o;
+
+		// clear the bit first: a poster sets it again after its push
+		__atomic_fetch_and(&l->fc_mask, ~RWL_LEVEL(p), __ATOMIC_SEQ_CST);
+		o = __atomic_exchange_n(&l->fc_pub[p], NULL, __ATOMIC_ACQUIRE);
+		// posted newest first, run them oldest first
+		while (o != NULL) {
+			struct rwl_fcop *next = o->next;
+			o->next = list;
+			list = o;
+			o = next;
+		}
+		while (list != NULL) {
+			if (ran == RWL_FC_BATCH) {
+				fc_defer(l, p, list);
+				return;
+			}
+			o = list;
+			list = o->next;
+			o->op(o->arg);
+			rwl_unpark(l, &o->done);
+			ran++;
+		}
+	}
 }
 
 //rwl_wunlock unlocks the lock held in the "write" mode
 void
 rwl_wunlock(rwl *l, int priority)
 {
-	pthread_mutex_lock(&l->mutex);
-	l->w_active[priority]--;
-	
-	int waiting_writer = get_highest_waiting_writer_priority(l);
-	if (waiting_writer != -1) {
-		pthread_cond_broadcast(&l->w_cond[waiting_writer]);
-	} else {
-		pthread_cond_broadcast(&l->r_cond);
+	assert(l->w_active[priority] == 1);
+	assert((state_load(l) & RWL_READER_MASK) == 0);
+	if (__atomic_load_n(&l->fc_mask, __ATOMIC_RELAXED) != 0) {
+		fc_run(l);
 	}
+	stats_released(l, priority);
+	l->w_active[priority]--;
+	seq_leave(l);
+	write_release(l);
+}
 
-	assert(l->r_active == 0);
-	pthread_mutex_unlock(&l->mutex);
-}
\ No newline at end of file
+//rwl_combine has op run by a writer holding the lock, and waits for that
+void
+rwl_combine(rwl *l, int priority, void (*op)(void *), void *arg)
+{
+	struct rwl_fcop self = { .op = op, .arg = arg, .done = 0, .lead = 0 };
+	struct rwl_fcop *head = __atomic_load_n(&l->fc_pub[priority],
+	    __ATOMIC_RELAXED);
+	unsigned int seq, bumps = 0;
+
+	assert(priority >= 0 && priority < RWL_LEVELS);
+	do {
+		self.next = head;
+	} while (!__atomic_compare_exchange_n(&l->fc_pub[priority], &head,
+	    &self, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	__atomic_fetch_or(&l->fc_mask, RWL_LEVEL(priority), __ATOMIC_SEQ_CST);
+
+	// first in an empty list: see to it that the list gets run, unless a
+	// writer already took it, and with it everybody who joined us
+	if (head == NULL && seq_load(&self.done) == 0) {
+		rwl_wlock(l, priority);
+		rwl_wunlock(l, priority);
+	}
+	// lead goes up before each bump that sends us for the lock, so more
+	// bumps than that and our write has run
+	for (;;) {
+		while (((seq = seq_load(&self.done)) >> 1) == bumps) {
+			rwl_park(l, &self.done, seq, NULL);
+		}
+		bumps = seq >> 1;
+		if (bumps > __atomic_load_n(&self.lead, __ATOMIC_RELAXED)) {
+			break;
+		}
+		rwl_wlock(l, priority);
+		rwl_wunlock(l, priority);
+	}
+}
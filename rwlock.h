@@ -1,20 +1,219 @@
 #ifndef RWLOCK_H
 #define RWLOCK_H
 
+#include <pthread.h>
+#include <time.h>
+
+/* The libraries are built with -fvisibility=hidden: they export what these
+ * headers declare and nothing else. */
+#pragma GCC visibility push(default)
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Waiters sleep on futexes on Linux.  Build with -DRWL_CONDVAR (everything
+ * including this header) to use a condition variable per lock instead. */
+#if defined(__linux__) && !defined(RWL_CONDVAR)
+#define RWL_FUTEX           1
+#endif
+
+/* Writer priorities run from 0, the highest, to RWL_LEVELS - 1.  Build with
+ * -DRWL_LEVELS=n for up to 64 (everything including this header). */
+#ifndef RWL_LEVELS
+#define RWL_LEVELS          3
+#endif
+#if RWL_LEVELS < 1 || RWL_LEVELS > 64
+#error "RWL_LEVELS must be between 1 and 64"
+#endif
+
+#define RWL_BIGREADER       0x1         // per-CPU reader counters, see rwlock.c
+#define RWL_ADAPTIVE        0x2         // spin briefly before parking
+#define RWL_PHASE_FAIR      0x4         // alternate read and write phases
+#define RWL_STATS           0x8         // count contention, see rwl_stats_get
+#define RWL_FIFO            0x10        // hand the lock to queued writers in turn
+
+typedef struct {
+	unsigned int        flags;      // RWL_* mode bits
+} rwl_attr;
+
+/* rwl is cache-line aligned and split into lines by who touches them, so
+ * that readers bumping l->state do not keep pulling in the writer queues
+ * and neighbouring locks in an array never share a line.  Heap-allocated
+ * locks therefore need aligned_alloc(RWL_CACHELINE, ...).  Build with
+ * -DRWL_COMPACT (everything including this header) for the packed layout.
+ */
+#define RWL_CACHELINE       64
+#ifdef RWL_COMPACT
+#define RWL_ALIGNED
+#else
+#define RWL_ALIGNED         __attribute__((aligned(RWL_CACHELINE)))
+#endif
+
+struct rwl_rslot;
+struct rwl_waiter;
+struct rwl_fcop;
+struct rwl_sslot;
+
 typedef struct {
-	pthread_mutex_t     mutex;
-	pthread_cond_t      r_cond;
-	pthread_cond_t      w_cond[3];
-	int                 r_active;
-	int                 w_active[3];
+	// uncontended lock and unlock only look at this line, and seq below
+	unsigned int        state;      // reader count, writer and waiting bits
+	unsigned int        flags;
+	struct rwl_rslot   *r_slots;    // RWL_BIGREADER only: one per CPU
+	struct rwl_sslot   *stats;      // RWL_STATS only: one per CPU
+
+	// wakeup words, and seq away from state so that optimistic readers
+	// do not lose their line to every plain reader bumping the count
+	unsigned int        seq RWL_ALIGNED; // odd while a writer holds the lock
+	unsigned int        r_seq;      // parked readers sleep here
+	unsigned int        d_seq;      // a writer waiting out readers sleeps here
+	unsigned int        r_phase;    // RWL_PHASE_FAIR: bumped per read phase
+
+	// writes posted by rwl_combine, see rwlock.c
+	unsigned long long  fc_mask RWL_ALIGNED; // bit p set: fc_pub[p] in use
+	struct rwl_fcop    *fc_pub[RWL_LEVELS];
+
+	// written by the writer holding the lock, and by RWL_ADAPTIVE spinners
+	// when their estimate moves
+	int                 w_active[RWL_LEVELS] RWL_ALIGNED;
+	int                 w_cpu;      // RWL_ADAPTIVE: CPU of the last writer
+	unsigned int        spin;       // RWL_ADAPTIVE: learned budget, << 3
+	int                 r_nslots;
+	int                 s_nslots;
+	unsigned long long  w_since;    // RWL_STATS: when the writer got in
+
+	// slow path: everything below is protected by mutex
+	pthread_mutex_t     mutex RWL_ALIGNED;
 	int                 r_wait;
-	int                 w_wait[3];
-}rwl;
+	int                 r_queued;   // RWL_PHASE_FAIR: readers for next phase
+	unsigned long long  w_mask;     // bit p set: writers of priority p queued
+	int                 w_wait[RWL_LEVELS];
+	struct rwl_waiter  *w_head[RWL_LEVELS]; // queued writers, FIFO per level
+	struct rwl_waiter  *w_tail[RWL_LEVELS];
+#ifndef RWL_FUTEX
+	pthread_mutex_t     park_mutex;
+	pthread_cond_t      park_cond;
+#endif
+} RWL_ALIGNED rwl;
 
 void rwl_init(rwl *l);
+void rwl_attr_init(rwl_attr *attr);
+int rwl_init_attr(rwl *l, const rwl_attr *attr);
+void rwl_destroy(rwl *l);
 void rwl_rlock(rwl *l);
 void rwl_runlock(rwl *l);
 void rwl_wlock(rwl *l, int priority);
 void rwl_wunlock(rwl *l, int priority);
 
-#endif
\ No newline at end of file
+// non-blocking variants: return 0 with the lock held, or EBUSY
+int rwl_tryrlock(rwl *l);
+int rwl_trywlock(rwl *l, int priority);
+
+// upgradeable reads: one holder at a time, alongside plain readers; the
+// hold ends with rwl_uunlock, or rwl_uupgrade and later rwl_wunlock
+void rwl_ulock(rwl *l);
+void rwl_uunlock(rwl *l);
+void rwl_uupgrade(rwl *l, int priority);
+// turn a write hold into a read hold, released with rwl_runlock
+void rwl_wdowngrade(rwl *l, int priority);
+
+/* Optimistic reads, for sections that copy a few words out and nothing
+ * else.  They write no shared memory; instead the reader checks afterwards
+ * that no writer was inside, and if one was it goes round once more with a
+ * real read lock, so every read ends after at most two passes:
+ *
+ *     unsigned int stamp = 0;
+ *     do {
+ *         rwl_oread_begin(l, &stamp);
+ *         copy = shared;          // may see a torn value, so no pointers
+ *     } while (rwl_oread_retry(l, &stamp));
+ *
+ * Fields read this way should be accessed with atomics (relaxed is enough)
+ * if the program is to be free of data races by the letter of C11.
+ */
+#define RWL_OREAD_LOCKED    1u          // stamp: this pass holds a read lock
+
+static inline void
+rwl_oread_begin(rwl *l, unsigned int *stamp)
+{
+	if (*stamp != RWL_OREAD_LOCKED) {
+		*stamp = __atomic_load_n(&l->seq, __ATOMIC_ACQUIRE);
+		if ((*stamp & 1) == 0) {
+			return;
+		}
+		// a writer is inside, do not bother guessing
+		*stamp = RWL_OREAD_LOCKED;
+	}
+	rwl_rlock(l);
+}
+
+static inline int
+rwl_oread_retry(rwl *l, unsigned int *stamp)
+{
+	if (*stamp == RWL_OREAD_LOCKED) {
+		rwl_runlock(l);
+		return 0;
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&l->seq, __ATOMIC_RELAXED) == *stamp) {
+		return 0;
+	}
+	*stamp = RWL_OREAD_LOCKED;
+	return 1;
+}
+
+/* Combined writes, for writers that only apply a small change.  The caller
+ * posts op and waits; whichever thread holds the lock for writing runs the
+ * posted ops, highest priority first and in posting order within one, up
+ * to a bounded batch before it lets go, so a burst of writers costs one
+ * lock handoff per batch rather than one each.  op usually runs on another
+ * thread, as a writer at the given priority, and must not take the lock. */
+void rwl_combine(rwl *l, int priority, void (*op)(void *), void *arg);
+
+// deadline-bounded variants: abstime is absolute, on CLOCK_MONOTONIC;
+// return 0 with the lock held, ETIMEDOUT or EINVAL
+int rwl_timedrlock(rwl *l, const struct timespec *abstime);
+int rwl_timedwlock(rwl *l, int priority, const struct timespec *abstime);
+
+/* Contention statistics of a RWL_STATS lock, for readers and for writers of
+ * each priority.  Upgrades and downgrades count as acquisitions in the new
+ * mode.  Times are in nanoseconds; the hold time of a read lock is only
+ * tracked for the innermost few read locks a thread holds at once. */
+typedef struct {
+	unsigned long long  acquired;   // times the lock was taken
+	unsigned long long  contended;  // of those, times the taker had to wait
+	unsigned long long  wait_ns;    // total time spent waiting
+	unsigned long long  wait_max_ns;
+	unsigned long long  hold_ns;    // total time the lock was held
+	unsigned long long  hold_max_ns;
+	unsigned long long  spurious;   // wakeups that found the lock still busy
+} rwl_stat;
+
+typedef struct {
+	rwl_stat            read;
+	rwl_stat            write[RWL_LEVELS];
+} rwl_stats;
+
+// rwl_stats_get adds up the counters without stopping anybody, so a
+// snapshot taken under load may be a few events out between fields;
+// returns 0, or EINVAL if the lock was not made with RWL_STATS
+int rwl_stats_get(rwl *l, rwl_stats *stats);
+
+#define RWL_TRACE_WAIT      0           // about to sleep, already queued
+#define RWL_TRACE_ACQUIRE   1           // the lock is now held
+#define RWL_TRACE_RELEASE   2           // the lock is about to be let go
+
+#ifdef RWL_TRACE
+/* Built with -DRWL_TRACE, every rwl calls rwl_trace_hook, when set, as a
+ * thread waits for, takes and releases it, on that thread and with the
+ * priority it asked for, or -1 for a reader; test_harness.c uses it to see
+ * who is waiting without asking the kernel.  The hook must not take the
+ * lock it is told about. */
+extern void (*rwl_trace_hook)(rwl *l, int event, int priority);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+#pragma GCC visibility pop
+
+#endif
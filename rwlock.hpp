@@ -0,0 +1,218 @@
+#ifndef RWLOCK_HPP
+#define RWLOCK_HPP
+
+#include <chrono>
+#include <ctime>
+#include <system_error>
+#include <utility>
+
+#include "rwlock.h"
+
+/* A header-only C++ layer over rwl; everything here inlines to the rwl_*
+ * calls it stands for and allocates nothing.
+ *
+ * SharedMutex meets the standard SharedTimedMutex requirements, so it works
+ * with std::shared_lock, std::unique_lock and std::scoped_lock.  Those only
+ * know one kind of exclusive lock, so a SharedMutex writes at the priority
+ * it was made with; WriteGuard takes it at any other.  Guarded<T> keeps a T
+ * behind a SharedMutex and only lets it be reached through a view that
+ * holds the lock:
+ *
+ *     rwlock::Guarded<std::map<int, int>> index;
+ *     index.write(1)->emplace(1, 2);      // write lock, priority 1
+ *     if (index.read()->count(1)) ...     // read lock
+ *     {
+ *         auto v = index.read();          // held until v goes away
+ *         for (auto &e : *v) ...
+ *     }
+ */
+
+namespace rwlock {
+
+class SharedMutex {
+public:
+	// flags are RWL_* mode bits; priority is the one lock() writes at
+	explicit SharedMutex(unsigned int flags = 0, int priority = 0)
+	    : priority_(priority)
+	{
+		rwl_attr attr;
+
+		rwl_attr_init(&attr);
+		attr.flags = flags;
+		int rc = rwl_init_attr(&l_, &attr);
+		if (rc != 0) {
+			throw std::system_error(rc, std::generic_category(),
+			    "rwl_init_attr");
+		}
+	}
+	~SharedMutex() { rwl_destroy(&l_); }
+	SharedMutex(const SharedMutex &) = delete;
+	SharedMutex &operator=(const SharedMutex &) = delete;
+
+	void lock() { rwl_wlock(&l_, priority_); }
+	bool try_lock() { return rwl_trywlock(&l_, priority_) == 0; }
+	void unlock() { rwl_wunlock(&l_, priority_); }
+
+	template <class Rep, class Period>
+	bool try_lock_for(const std::chrono::duration<Rep, Period> &timeout)
+	{
+		timespec ts = deadline(timeout);
+		return rwl_timedwlock(&l_, priority_, &ts) == 0;
+	}
+
+	template <class Clock, class Duration>
+	bool try_lock_until(const std::chrono::time_point<Clock, Duration> &t)
+	{
+		return try_lock_for(t - Clock::now());
+	}
+
+	void lock_shared() { rwl_rlock(&l_); }
+	bool try_lock_shared() { return rwl_tryrlock(&l_) == 0; }
+	void unlock_shared() { rwl_runlock(&l_); }
+
+	template <class Rep, class Period>
+	bool try_lock_shared_for(
+	    const std::chrono::duration<Rep, Period> &timeout)
+	{
+		timespec ts = deadline(timeout);
+		return rwl_timedrlock(&l_, &ts) == 0;
+	}
+
+	template <class Clock, class Duration>
+	bool try_lock_shared_until(
+	    const std::chrono::time_point<Clock, Duration> &t)
+	{
+		return try_lock_shared_for(t - Clock::now());
+	}
+
+	int priority() const { return priority_; }
+	::rwl *native_handle() { return &l_; }
+
+private:
+	/* rwl deadlines are absolute CLOCK_MONOTONIC times; timeouts past
+	 * zero mean one try, and absurdly long ones are cut to a century */
+	template <class Rep, class Period>
+	static timespec deadline(const std::chrono::duration<Rep, Period> &d)
+	{
+		using namespace std::chrono;
+		const nanoseconds cap = hours(24 * 365 * 100);
+		// compared in floating point, where nothing overflows
+		nanoseconds left = d <= d.zero() ? nanoseconds(0) :
+		    duration<double>(d) >= cap ? cap :
+		    duration_cast<nanoseconds>(d);
+		timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		long long ns = ts.tv_nsec + left.count() % 1000000000;
+		ts.tv_sec += left.count() / 1000000000 + ns / 1000000000;
+		ts.tv_nsec = ns % 1000000000;
+		return ts;
+	}
+
+	::rwl l_;
+	int priority_;
+};
+
+// WriteGuard holds a SharedMutex for writing at a given priority
+class WriteGuard {
+public:
+	WriteGuard(SharedMutex &m, int priority)
+	    : l_(m.native_handle()), priority_(priority)
+	{
+		rwl_wlock(l_, priority_);
+	}
+	~WriteGuard() { rwl_wunlock(l_, priority_); }
+	WriteGuard(const WriteGuard &) = delete;
+	WriteGuard &operator=(const WriteGuard &) = delete;
+
+private:
+	::rwl *l_;
+	int priority_;
+};
+
+template <class T>
+class Guarded {
+public:
+	/* ReadView is a read lock on a Guarded and const access to its value;
+	 * it can be moved out of a function but not copied */
+	class ReadView {
+	public:
+		ReadView(ReadView &&o) noexcept : g_(std::exchange(o.g_, nullptr))
+		{
+		}
+		~ReadView()
+		{
+			if (g_ != nullptr) {
+				rwl_runlock(g_->m_.native_handle());
+			}
+		}
+		ReadView(const ReadView &) = delete;
+		ReadView &operator=(const ReadView &) = delete;
+		ReadView &operator=(ReadView &&) = delete;
+
+		const T &operator*() const { return g_->value_; }
+		const T *operator->() const { return &g_->value_; }
+
+	private:
+		friend class Guarded;
+		explicit ReadView(const Guarded *g) : g_(g)
+		{
+			rwl_rlock(g_->m_.native_handle());
+		}
+
+		const Guarded *g_;
+	};
+
+	// WriteView is the same for a write lock and mutable access
+	class WriteView {
+	public:
+		WriteView(WriteView &&o) noexcept
+		    : g_(std::exchange(o.g_, nullptr)), priority_(o.priority_)
+		{
+		}
+		~WriteView()
+		{
+			if (g_ != nullptr) {
+				rwl_wunlock(g_->m_.native_handle(), priority_);
+			}
+		}
+		WriteView(const WriteView &) = delete;
+		WriteView &operator=(const WriteView &) = delete;
+		WriteView &operator=(WriteView &&) = delete;
+
+		T &operator*() const { return g_->value_; }
+		T *operator->() const { return &g_->value_; }
+
+	private:
+		friend class Guarded;
+		WriteView(Guarded *g, int priority) : g_(g), priority_(priority)
+		{
+			rwl_wlock(g_->m_.native_handle(), priority_);
+		}
+
+		Guarded *g_;
+		int priority_;
+	};
+
+	// the arguments go to T's constructor
+	template <class... Args>
+	explicit Guarded(Args &&...args) : value_(std::forward<Args>(args)...)
+	{
+	}
+	Guarded(const Guarded &) = delete;
+	Guarded &operator=(const Guarded &) = delete;
+
+	ReadView read() const { return ReadView(this); }
+	WriteView write(int priority = 0) { return WriteView(this, priority); }
+
+	// the lock itself, for std::shared_lock and friends
+	SharedMutex &mutex() const { return m_; }
+
+private:
+	mutable SharedMutex m_;
+	T value_;
+};
+
+} // namespace rwlock
+
+#endif
@@ -0,0 +1,437 @@
+#ifndef RWLOCK_CORO_HPP
+#define RWLOCK_CORO_HPP
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <cstdint>
+#include <utility>
+
+#include "rwlock_policy.hpp"
+
+/* rwlock::co_rwl<Levels> is a reader-writer lock for coroutines, C++20:
+ *
+ *     rwlock::co_rwl<> index_lock;
+ *     {
+ *         auto r = co_await index_lock.read();     // held until r goes away
+ *         ...
+ *     }
+ *     auto w = co_await index_lock.write(1);      // priority 1
+ *
+ * A coroutine that cannot have the lock at once is suspended and queued
+ * in the lock, and whoever releases the lock to it resumes it, on its own
+ * thread and before returning from the release.  A release made by a
+ * coroutine resumed that way only queues the next one on the thread, and
+ * the outermost release resumes them in turn, so a chain of handoffs takes
+ * no more stack than one.  read(ex) and write(priority, ex) have it posted
+ * to ex instead, with ex.post(h), for anything with a post that takes a
+ * std::coroutine_handle<> or any other callable.  No thread ever blocks on
+ * the lock; the guard of the queues is a spinlock held to link or unlink a
+ * waiter and nothing else.
+ *
+ * The rules are those of an RWL_FIFO rwl: a queued writer keeps new
+ * readers out, writers are handed the lock directly, highest priority
+ * first and FIFO within a priority, and readers queued behind writers all
+ * go in together when the last writer leaves.  Waiters are nodes in the
+ * awaiting coroutine's frame and nothing is allocated.
+ */
+
+namespace rwlock {
+
+namespace detail {
+
+struct co_waiter;
+
+// co_trampoline holds the coroutines a thread has been handed to resume
+struct co_trampoline {
+	co_waiter *head = nullptr;
+	co_waiter *tail = nullptr;
+	bool running = false;
+};
+
+inline thread_local co_trampoline trampoline;
+
+// co_waiter is a suspended coroutine queued for a co_rwl
+struct co_waiter {
+	std::coroutine_handle<> h;
+	void (*post)(void *, std::coroutine_handle<>) = nullptr;
+	void *ex = nullptr;         // passed to post
+	co_waiter *next = nullptr;
+
+	void
+	wake()
+	{
+		co_trampoline &t = trampoline;
+
+		if (post != nullptr) {
+			post(ex, h);
+			return;
+		}
+		next = nullptr;
+		if (t.tail == nullptr) {
+			t.head = this;
+		} else {
+			t.tail->next = this;
+		}
+		t.tail = this;
+		// a release under a resume below only queues; we resume it
+		if (t.running) {
+			return;
+		}
+		t.running = true;
+		while (t.head != nullptr) {
+			co_waiter *w = t.head;
+
+			t.head = w->next;
+			if (t.head == nullptr) {
+				t.tail = nullptr;
+			}
+			// w is gone once resumed
+			w->h.resume();
+		}
+		t.running = false;
+	}
+};
+
+template <class Executor>
+void
+post_to(void *ex, std::coroutine_handle<> h)
+{
+	static_cast<Executor *>(ex)->post(h);
+}
+
+} // namespace detail
+
+template <int Levels = 3>
+class co_rwl {
+	static_assert(Levels >= 1 && Levels <= 64,
+	    "Levels must be between 1 and 64");
+
+public:
+	// ReadGuard is a read hold; it can be moved but not copied
+	class ReadGuard {
+	public:
+		ReadGuard(ReadGuard &&o) noexcept
+		    : l_(std::exchange(o.l_, nullptr))
+		{
+		}
+		~ReadGuard() { unlock(); }
+		ReadGuard(const ReadGuard &) = delete;
+		ReadGuard &operator=(const ReadGuard &) = delete;
+		ReadGuard &operator=(ReadGuard &&) = delete;
+
+		// gives the lock up before the guard goes away
+		void
+		unlock()
+		{
+			if (l_ != nullptr) {
+				std::exchange(l_, nullptr)->unlock_shared();
+			}
+		}
+
+	private:
+		friend class co_rwl;
+		explicit ReadGuard(co_rwl *l) : l_(l) {}
+
+		co_rwl *l_;
+	};
+
+	// WriteGuard is the same for a write hold
+	class WriteGuard {
+	public:
+		WriteGuard(WriteGuard &&o) noexcept
+		    : l_(std::exchange(o.l_, nullptr))
+		{
+		}
+		~WriteGuard() { unlock(); }
+		WriteGuard(const WriteGuard &) = delete;
+		WriteGuard &operator=(const WriteGuard &) = delete;
+		WriteGuard &operator=(WriteGuard &&) = delete;
+
+		void
+		unlock()
+		{
+			if (l_ != nullptr) {
+				std::exchange(l_, nullptr)->unlock();
+			}
+		}
+
+	private:
+		friend class co_rwl;
+		explicit WriteGuard(co_rwl *l) : l_(l) {}
+
+		co_rwl *l_;
+	};
+
+	class ReadAwaiter {
+	public:
+		bool await_ready() { return l_.try_lock_shared(); }
+
+		bool
+		await_suspend(std::coroutine_handle<> h)
+		{
+			w_.h = h;
+			return l_.queue_reader(&w_);
+		}
+
+		[[nodiscard]] ReadGuard await_resume() { return ReadGuard(&l_); }
+
+	private:
+		friend class co_rwl;
+		ReadAwaiter(co_rwl &l, void (*post)(void *,
+		    std::coroutine_handle<>), void *ex) : l_(l)
+		{
+			w_.post = post;
+			w_.ex = ex;
+		}
+
+		co_rwl &l_;
+		detail::co_waiter w_;
+	};
+
+	class WriteAwaiter {
+	public:
+		bool await_ready() { return l_.try_lock(); }
+
+		bool
+		await_suspend(std::coroutine_handle<> h)
+		{
+			w_.h = h;
+			return l_.queue_writer(priority_, &w_);
+		}
+
+		[[nodiscard]] WriteGuard await_resume()
+		{
+			return WriteGuard(&l_);
+		}
+
+	private:
+		friend class co_rwl;
+		WriteAwaiter(co_rwl &l, int priority, void (*post)(void *,
+		    std::coroutine_handle<>), void *ex)
+		    : l_(l), priority_(priority)
+		{
+			assert(priority >= 0 && priority < Levels);
+			w_.post = post;
+			w_.ex = ex;
+		}
+
+		co_rwl &l_;
+		int priority_;
+		detail::co_waiter w_;
+	};
+
+	co_rwl() = default;
+	co_rwl(const co_rwl &) = delete;
+	co_rwl &operator=(const co_rwl &) = delete;
+	~co_rwl() { assert(state_.load() == 0); }
+
+	ReadAwaiter read() { return ReadAwaiter(*this, nullptr, nullptr); }
+
+	template <class Executor>
+	ReadAwaiter
+	read(Executor &ex)
+	{
+		return ReadAwaiter(*this, &detail::post_to<Executor>, &ex);
+	}
+
+	WriteAwaiter
+	write(int priority = 0)
+	{
+		return WriteAwaiter(*this, priority, nullptr, nullptr);
+	}
+
+	template <class Executor>
+	WriteAwaiter
+	write(int priority, Executor &ex)
+	{
+		return WriteAwaiter(*this, priority, &detail::post_to<Executor>,
+		    &ex);
+	}
+
+	/* The holds themselves, for code that keeps track of them without
+	 * guards; unlocking may resume the next holders before it returns. */
+	bool
+	try_lock_shared()
+	{
+		uint32_t s = state_.load(std::memory_order_relaxed);
+
+		while ((s & (WRITER | W_WAIT)) == 0) {
+			if (state_.compare_exchange_weak(s, s + READER,
+			    std::memory_order_acquire, std::memory_order_relaxed)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool
+	try_lock()
+	{
+		uint32_t s = 0;
+
+		return state_.compare_exchange_strong(s, WRITER,
+		    std::memory_order_acquire, std::memory_order_relaxed);
+	}
+
+	void
+	unlock_shared()
+	{
+		uint32_t s = state_.fetch_sub(READER, std::memory_order_acq_rel) -
+		    READER;
+
+		// the last reader out hands the lock to the first writer
+		if ((s & (READERS | WRITER)) == 0 && (s & W_WAIT) != 0) {
+			hand_over();
+		}
+	}
+
+	void
+	unlock()
+	{
+		uint32_t s = WRITER;
+
+		if (state_.compare_exchange_strong(s, 0,
+		    std::memory_order_release, std::memory_order_relaxed)) {
+			return;
+		}
+		guard_lock();
+		// R_WAIT may have been set since, but only under the guard
+		s = state_.load();
+		if (!w_q_.empty()) {
+			// the first writer gets the lock as it is, still taken
+			detail::co_waiter *w = take_writer();
+			guard_unlock();
+			w->wake();
+			return;
+		}
+		// every queued reader goes in, counted before any of them runs
+		detail::co_waiter *r = r_head_;
+		uint32_t n = 0;
+		for (detail::co_waiter *p = r; p != nullptr; p = p->next) {
+			n++;
+		}
+		r_head_ = r_tail_ = nullptr;
+		state_.fetch_add(n * READER - WRITER - (s & R_WAIT));
+		guard_unlock();
+		while (r != nullptr) {
+			// r is gone once woken
+			detail::co_waiter *next = r->next;
+			r->wake();
+			r = next;
+		}
+	}
+
+private:
+	static constexpr uint32_t WRITER = 1;
+	static constexpr uint32_t W_WAIT = 2;
+	static constexpr uint32_t R_WAIT = 4;
+	static constexpr uint32_t READER = 8;
+	static constexpr uint32_t READERS = ~(WRITER | W_WAIT | R_WAIT);
+
+	void
+	guard_lock()
+	{
+		for (unsigned int i = 1; guard_.test_and_set(
+		    std::memory_order_acquire); i++) {
+			if (i % 64 == 0) {
+				sched_yield();
+			} else {
+				detail::cpu_relax();
+			}
+		}
+	}
+
+	void guard_unlock() { guard_.clear(std::memory_order_release); }
+
+	/* queue_reader queues w unless the lock can be had after all, and
+	 * tells the awaiter whether to stay suspended */
+	bool
+	queue_reader(detail::co_waiter *w)
+	{
+		guard_lock();
+		uint32_t s = state_.load();
+		for (;;) {
+			if ((s & (WRITER | W_WAIT)) == 0) {
+				if (state_.compare_exchange_weak(s, s + READER)) {
+					guard_unlock();
+					return false;
+				}
+			} else if (state_.compare_exchange_weak(s, s | R_WAIT)) {
+				// the writer in or queued will see R_WAIT
+				break;
+			}
+		}
+		if (r_head_ == nullptr) {
+			r_head_ = w;
+		} else {
+			r_tail_->next = w;
+		}
+		r_tail_ = w;
+		// w may be resumed and gone as soon as the guard is let go
+		guard_unlock();
+		return true;
+	}
+
+	bool
+	queue_writer(int priority, detail::co_waiter *w)
+	{
+		guard_lock();
+		w_q_.push(priority, w);
+		uint32_t s = state_.fetch_or(W_WAIT) | W_WAIT;
+		// nobody will hand over a free lock, take it if we are next
+		while (w_q_.front() == w && (s & (READERS | WRITER)) == 0) {
+			if (state_.compare_exchange_weak(s, s | WRITER)) {
+				take_writer();
+				guard_unlock();
+				return false;
+			}
+		}
+		guard_unlock();
+		return true;
+	}
+
+	// take_writer dequeues the next writer, with the guard held
+	detail::co_waiter *
+	take_writer()
+	{
+		detail::co_waiter *w = w_q_.pop();
+
+		if (w_q_.empty()) {
+			state_.fetch_and(~W_WAIT);
+		}
+		return w;
+	}
+
+	// hand_over gives a free lock to the next writer, if there is one
+	void
+	hand_over()
+	{
+		detail::co_waiter *w = nullptr;
+
+		guard_lock();
+		uint32_t s = state_.load();
+		while (!w_q_.empty() && (s & (READERS | WRITER)) == 0) {
+			if (state_.compare_exchange_weak(s, s | WRITER)) {
+				w = take_writer();
+				break;
+			}
+		}
+		guard_unlock();
+		if (w != nullptr) {
+			w->wake();
+		}
+	}
+
+	// readers and uncontended writers only touch this line
+	alignas(64) std::atomic<uint32_t> state_{0}; // readers and the bits
+
+	alignas(64) std::atomic_flag guard_ = ATOMIC_FLAG_INIT;
+	detail::writer_queue<Levels, detail::co_waiter> w_q_; // under guard_
+	detail::co_waiter *r_head_ = nullptr;   // queued readers, FIFO
+	detail::co_waiter *r_tail_ = nullptr;
+};
+
+} // namespace rwlock
+
+#endif
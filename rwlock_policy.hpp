@@ -0,0 +1,451 @@
+#ifndef RWLOCK_POLICY_HPP
+#define RWLOCK_POLICY_HPP
+
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <cstdint>
+#include <sched.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* rwlock::rwl<Policy, Levels, Wait> is a reader-writer lock whose rules are
+ * fixed at compile time, for locks that do not need everything rwl_init
+ * sets up at run time:
+ *
+ *     rwlock::rwl<rwlock::ReaderPreferred, 1, rwlock::Spin> config_lock;
+ *     rwlock::rwl<rwlock::WriterPreferred, 3, rwlock::Park> queue_lock;
+ *
+ * Policy decides whether a queued writer keeps new readers out, as in
+ * rwlock.c (WriterPreferred), or only a writer inside does
+ * (ReaderPreferred).  Writers queue FIFO within each of Levels priorities,
+ * 0 the highest, and are handed the lock directly, highest priority first;
+ * with one level there is a single FIFO and no priority mask.  Wait is how
+ * a thread waits: Spin never sleeps, Park sleeps on a futex at once, and
+ * SpinThenPark<n> spins n rounds first.  With Spin nothing is counted for
+ * wakeups and no system call is ever made.
+ *
+ * The members are those of std::shared_mutex, lock() taking an optional
+ * priority, so std::shared_lock and std::unique_lock work with it.  Nothing
+ * is allocated: a waiting writer queues a node on its own stack.
+ */
+
+namespace rwlock {
+
+// a queued writer keeps new readers out, as with rwl
+struct WriterPreferred {
+	static constexpr bool writers_first = true;
+};
+
+// only a writer holding the lock keeps readers out; writers can starve
+struct ReaderPreferred {
+	static constexpr bool writers_first = false;
+};
+
+namespace detail {
+
+inline void
+cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+// futex_wait sleeps while word holds old; it may return early
+inline void
+futex_wait(std::atomic<uint32_t> &word, uint32_t old)
+{
+#ifdef __linux__
+	syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word),
+	    FUTEX_WAIT_PRIVATE, old, nullptr, nullptr, 0);
+#else
+	(void)word;
+	(void)old;
+	sched_yield();
+#endif
+}
+
+inline void
+futex_wake(std::atomic<uint32_t> &word, int n)
+{
+#ifdef __linux__
+	syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word),
+	    FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+#else
+	(void)word;
+	(void)n;
+#endif
+}
+
+} // namespace detail
+
+/* Wait strategies: wait(word, old) returns once word may have moved on from
+ * old, and wake(word, n) is called after it has, to wake n waiters. */
+
+// Spin burns its CPU, giving it up now and then in case the holder needs it
+struct Spin {
+	static constexpr bool parks = false;
+
+	static void
+	wait(std::atomic<uint32_t> &word, uint32_t old)
+	{
+		for (unsigned int i = 1; word.load(std::memory_order_acquire) ==
+		    old; i++) {
+			if (i % 128 == 0) {
+				sched_yield();
+			} else {
+				detail::cpu_relax();
+			}
+		}
+	}
+
+	static void wake(std::atomic<uint32_t> &, int) {}
+};
+
+// Park goes straight to sleep
+struct Park {
+	static constexpr bool parks = true;
+
+	static void
+	wait(std::atomic<uint32_t> &word, uint32_t old)
+	{
+		detail::futex_wait(word, old);
+	}
+
+	static void
+	wake(std::atomic<uint32_t> &word, int n)
+	{
+		detail::futex_wake(word, n);
+	}
+};
+
+// SpinThenPark spins Rounds times before going to sleep
+template <unsigned int Rounds>
+struct SpinThenPark {
+	static constexpr bool parks = true;
+
+	static void
+	wait(std::atomic<uint32_t> &word, uint32_t old)
+	{
+		for (unsigned int i = 0; i < Rounds; i++) {
+			if (word.load(std::memory_order_acquire) != old) {
+				return;
+			}
+			detail::cpu_relax();
+		}
+		detail::futex_wait(word, old);
+	}
+
+	static void
+	wake(std::atomic<uint32_t> &word, int n)
+	{
+		detail::futex_wake(word, n);
+	}
+};
+
+namespace detail {
+
+struct waiter {
+	std::atomic<uint32_t> granted{0};
+	waiter *next = nullptr;
+};
+
+/* writer_queue keeps queued writers, FIFO per priority, under the guard;
+ * Node is anything with a next pointer to another */
+template <int Levels, class Node = waiter>
+struct writer_queue {
+	uint64_t mask = 0;          // bit p set: writers of priority p queued
+	Node *head[Levels] = {};
+	Node *tail[Levels] = {};
+
+	bool empty() const { return mask == 0; }
+	Node *front() const { return head[__builtin_ctzll(mask)]; }
+
+	void
+	push(int priority, Node *w)
+	{
+		if (head[priority] == nullptr) {
+			head[priority] = w;
+		} else {
+			tail[priority]->next = w;
+		}
+		tail[priority] = w;
+		mask |= 1ull << priority;
+	}
+
+	Node *
+	pop()
+	{
+		int p = __builtin_ctzll(mask);
+		Node *w = head[p];
+
+		head[p] = w->next;
+		if (head[p] == nullptr) {
+			tail[p] = nullptr;
+			mask &= ~(1ull << p);
+		}
+		return w;
+	}
+};
+
+// with one level there is nothing to order by
+template <class Node>
+struct writer_queue<1, Node> {
+	Node *head = nullptr;
+	Node *tail = nullptr;
+
+	bool empty() const { return head == nullptr; }
+	Node *front() const { return head; }
+
+	void
+	push(int, Node *w)
+	{
+		if (head == nullptr) {
+			head = w;
+		} else {
+			tail->next = w;
+		}
+		tail = w;
+	}
+
+	Node *
+	pop()
+	{
+		Node *w = head;
+
+		head = w->next;
+		if (head == nullptr) {
+			tail = nullptr;
+		}
+		return w;
+	}
+};
+
+} // namespace detail
+
+template <class Policy = WriterPreferred, int Levels = 3, class Wait = Park>
+class rwl {
+	static_assert(Levels >= 1 && Levels <= 64,
+	    "Levels must be between 1 and 64");
+
+public:
+	rwl() = default;
+	rwl(const rwl &) = delete;
+	rwl &operator=(const rwl &) = delete;
+
+	void
+	lock_shared()
+	{
+		uint32_t s = state_.load(std::memory_order_relaxed);
+
+		for (;;) {
+			if ((s & R_BLOCK) == 0) {
+				if (state_.compare_exchange_weak(s, s + READER,
+				    std::memory_order_acquire,
+				    std::memory_order_relaxed)) {
+					return;
+				}
+				continue;
+			}
+			// whoever unblocks readers bumps r_seq_ after changing
+			// state_, so reading them in the other order cannot
+			// miss it
+			uint32_t seq = r_seq_.load();
+			s = state_.load();
+			if ((s & R_BLOCK) != 0) {
+				if constexpr (Wait::parks) {
+					r_sleepers_.fetch_add(1);
+				}
+				Wait::wait(r_seq_, seq);
+				if constexpr (Wait::parks) {
+					r_sleepers_.fetch_sub(1);
+				}
+				s = state_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool
+	try_lock_shared()
+	{
+		uint32_t s = state_.load(std::memory_order_relaxed);
+
+		while ((s & R_BLOCK) == 0) {
+			if (state_.compare_exchange_weak(s, s + READER,
+			    std::memory_order_acquire, std::memory_order_relaxed)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void
+	unlock_shared()
+	{
+		uint32_t s = state_.fetch_sub(READER, std::memory_order_acq_rel) -
+		    READER;
+
+		// the last reader out hands the lock to the first writer
+		if ((s & (READERS | WRITER)) == 0 && (s & W_WAIT) != 0) {
+			hand_over();
+		}
+	}
+
+	void
+	lock(int priority = 0)
+	{
+		uint32_t s = 0;
+
+		assert(priority >= 0 && priority < Levels);
+		if (state_.compare_exchange_strong(s, WRITER,
+		    std::memory_order_acquire, std::memory_order_relaxed)) {
+			return;
+		}
+		detail::waiter self;
+		guard_lock();
+		q_.push(priority, &self);
+		s = state_.fetch_or(W_WAIT) | W_WAIT;
+		// nobody will hand over a free lock, take it if we are next
+		while (q_.front() == &self && (s & (READERS | WRITER)) == 0) {
+			if (state_.compare_exchange_weak(s, s | WRITER)) {
+				take_front();
+				guard_unlock();
+				return;
+			}
+		}
+		guard_unlock();
+		while (self.granted.load(std::memory_order_acquire) == 0) {
+			Wait::wait(self.granted, 0);
+		}
+	}
+
+	bool
+	try_lock()
+	{
+		uint32_t s = 0;
+
+		return state_.compare_exchange_strong(s, WRITER,
+		    std::memory_order_acquire, std::memory_order_relaxed);
+	}
+
+	void
+	unlock()
+	{
+		uint32_t s = WRITER;
+
+		if (state_.compare_exchange_strong(s, 0,
+		    std::memory_order_release, std::memory_order_relaxed)) {
+			wake_readers();
+			return;
+		}
+		if constexpr (Policy::writers_first) {
+			// writers are queued: the first of them gets the lock as
+			// it is, still marked taken
+			guard_lock();
+			detail::waiter *w = take_front();
+			guard_unlock();
+			grant(w);
+		} else {
+			// readers go first; the writers get it from the last of
+			// them, or from us if none came
+			state_.fetch_and(~WRITER);
+			wake_readers();
+			hand_over();
+		}
+	}
+
+private:
+	static constexpr uint32_t WRITER = 1;
+	static constexpr uint32_t W_WAIT = 2;
+	static constexpr uint32_t READER = 4;
+	static constexpr uint32_t READERS = ~(WRITER | W_WAIT);
+	// what keeps a new reader out
+	static constexpr uint32_t R_BLOCK =
+	    Policy::writers_first ? WRITER | W_WAIT : WRITER;
+
+	void
+	guard_lock()
+	{
+		for (unsigned int i = 1; guard_.test_and_set(
+		    std::memory_order_acquire); i++) {
+			if (i % 64 == 0) {
+				sched_yield();
+			} else {
+				detail::cpu_relax();
+			}
+		}
+	}
+
+	void guard_unlock() { guard_.clear(std::memory_order_release); }
+
+	// take_front dequeues the next writer, with the guard held
+	detail::waiter *
+	take_front()
+	{
+		detail::waiter *w = q_.pop();
+
+		if (q_.empty()) {
+			state_.fetch_and(~W_WAIT);
+		}
+		return w;
+	}
+
+	// hand_over gives a free lock to the next writer, if there is one
+	void
+	hand_over()
+	{
+		detail::waiter *w = nullptr;
+
+		guard_lock();
+		uint32_t s = state_.load();
+		while (!q_.empty() && (s & (READERS | WRITER)) == 0) {
+			if (state_.compare_exchange_weak(s, s | WRITER)) {
+				w = take_front();
+				break;
+			}
+		}
+		guard_unlock();
+		if (w != nullptr) {
+			grant(w);
+		}
+	}
+
+	// w's stack frame may be gone as soon as it sees granted
+	void
+	grant(detail::waiter *w)
+	{
+		w->granted.store(1, std::memory_order_release);
+		Wait::wake(w->granted, 1);
+	}
+
+	void
+	wake_readers()
+	{
+		r_seq_.fetch_add(1);
+		if constexpr (Wait::parks) {
+			if (r_sleepers_.load() != 0) {
+				Wait::wake(r_seq_, INT_MAX);
+			}
+		}
+	}
+
+	// readers and uncontended writers only touch this line
+	alignas(64) std::atomic<uint32_t> state_{0}; // readers, WRITER, W_WAIT
+	std::atomic<uint32_t> r_seq_{0};    // bumped when readers may go
+	std::atomic<uint32_t> r_sleepers_{0}; // parked readers, if Wait parks
+
+	alignas(64) std::atomic_flag guard_ = ATOMIC_FLAG_INIT;
+	detail::writer_queue<Levels> q_;    // protected by guard_
+};
+
+} // namespace rwlock
+
+#endif
@@ -0,0 +1,62 @@
+#!/bin/sh
+# sweep.sh runs bench over every lock mode and backend with the same
+# workloads, threads pinned, and prints one CSV table:
+#
+#   mode,wmix,threads,read_pct,cs_loops,ops_per_sec,vcsw_per_kop
+#
+# The dimensions can be narrowed from the environment, e.g.
+#
+#   MODES="rwl qrwl" THREADS="1 4" DURATION=1 ./sweep.sh > bench.csv
+#
+# Modes are the lock flavours bench can drive: rwl, bigreader, adaptive,
+# phasefair, optimistic, combine, stats, qrwl, cohort, prwl (the
+# process-shared lock), compact (the packed layout) and condvar (the
+# condition variable backend).
+
+ALL_MODES="rwl bigreader adaptive phasefair optimistic combine stats qrwl
+cohort prwl compact condvar"
+NCPU=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)
+
+MODES=${MODES:-$ALL_MODES}
+THREADS=${THREADS:-"1 2 4 8 $((NCPU * 2))"}
+READS=${READS:-"0 50 90 99"}
+CS=${CS:-"10 100 1000"}
+# writer priority weights, highest priority first
+MIXES=${MIXES:-"1:1:1 8:1:1 1:1:8"}
+DURATION=${DURATION:-2}
+
+# bench_args prints the binary and flags that run a mode
+bench_args() {
+	case $1 in
+	rwl)        echo "./bench" ;;
+	bigreader)  echo "./bench -b" ;;
+	adaptive)   echo "./bench -a" ;;
+	phasefair)  echo "./bench -f" ;;
+	optimistic) echo "./bench -o" ;;
+	combine)    echo "./bench -m" ;;
+	stats)      echo "./bench -s" ;;
+	qrwl)       echo "./bench -q" ;;
+	cohort)     echo "./bench -k 8" ;;
+	prwl)       echo "./bench -P" ;;
+	compact)    echo "./bench_compact" ;;
+	condvar)    echo "./bench_condvar" ;;
+	*)          return 1 ;;
+	esac
+}
+
+echo "mode,wmix,threads,read_pct,cs_loops,ops_per_sec,vcsw_per_kop"
+for mode in $MODES; do
+	args=$(bench_args "$mode") || { echo "unknown mode $mode" >&2; exit 1; }
+	# thread counts repeat when NCPU * 2 is already in the list
+	for t in $(echo $THREADS | tr ' ' '\n' | sort -n | uniq); do
+		for r in $READS; do
+			for c in $CS; do
+				for w in $MIXES; do
+					line=$($args -p -t "$t" -r "$r" -c "$c" -w "$w" \
+					    -d "$DURATION" 2>/dev/null) || exit 1
+					echo "$mode,$w,$line"
+				done
+			done
+		done
+	done
+done
@@ -0,0 +1,180 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+#define gettid() syscall(SYS_gettid)
+
+#include "rwlock.h"
+#include "test_common.h"
+
+typedef enum{true, false} bool;
+
+/*
+big-reader tests seq, on an RWL_BIGREADER lock:
+Readers 0-3 take read, each pinned to its own CPU where there are enough,
+    and hold it: all inside together
+Writer 0 (priority 1) arrives and waits for them to leave
+Reader 4 arrives and waits behind Writer 0
+Readers 0-3 release: Writer 0 goes first, then Reader 4
+Main takes read on the first CPU, moves to the last one and releases
+    there: the per-CPU counts still add up, and a write can be had
+Writers 0-1 and Readers 0-1 hammer the lock: readers never see a write half
+    done and no write is lost
+*/
+
+#define t_num 6
+#define r_hold 4
+#define ROUNDS 20000
+
+rwl rwlock;
+int t_prior[t_num] = {-1, -1, -1, -1, 1, -1};
+volatile int t_tid[t_num];
+volatile int order[t_num];
+volatile int n_in, n_done;
+volatile int hold;
+long a, b;
+volatile int torn;
+
+// pin binds the calling thread to the n-th online CPU, modulo their number
+void pin(int n) {
+    cpu_set_t set;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    CPU_ZERO(&set);
+    CPU_SET(n % (ncpu > 0 ? ncpu : 1), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+void * worker(void* args) {
+    int id = *(int *)args;
+    t_tid[id] = gettid();
+    if(id < r_hold){
+        pin(id);
+    }
+    if(t_prior[id] < 0){
+        rwl_rlock(&rwlock);
+    }else{
+        rwl_wlock(&rwlock, t_prior[id]);
+    }
+    __atomic_fetch_add(&n_in, 1, __ATOMIC_SEQ_CST);
+    if(id < r_hold){
+        while(hold){
+            usleep(1000);
+        }
+    }else{
+        order[__atomic_fetch_add(&n_done, 1, __ATOMIC_SEQ_CST)] = id;
+    }
+    if(t_prior[id] < 0){
+        rwl_runlock(&rwlock);
+    }else{
+        rwl_wunlock(&rwlock, t_prior[id]);
+    }
+    pthread_exit(NULL);
+}
+
+void * hammer_write(void* args) {
+    int priority = *(int *)args;
+    for(int k = 0; k < ROUNDS; k++){
+        rwl_wlock(&rwlock, priority);
+        a++;
+        b++;
+        rwl_wunlock(&rwlock, priority);
+    }
+    pthread_exit(NULL);
+}
+
+void * hammer_read(void* args) {
+    pin(*(int *)args);
+    for(int k = 0; k < ROUNDS; k++){
+        rwl_rlock(&rwlock);
+        if(a != b){
+            torn = 1;
+        }
+        rwl_runlock(&rwlock);
+    }
+    pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[]) {
+    pthread_t th[t_num];
+    int id[t_num];
+    rwl_attr attr;
+    bool passed = true;
+
+    printf("big-reader test:\n");
+    rwl_attr_init(&attr);
+    attr.flags = RWL_BIGREADER;
+    if(rwl_init_attr(&rwlock, &attr) != 0){
+        printf("failed to initialize the lock!\n");
+        return 0;
+    }
+
+    hold = 1;
+    for(int i = 0; i < t_num; i++){
+        id[i] = i;
+        if(pthread_create(&th[i], NULL, &worker, &id[i]) != 0){
+            printf("Failed to create threads!\n");
+            return 0;
+        }
+        if(i < r_hold){
+            while(n_in != i + 1){
+                usleep(1000);
+            }
+        }else if(wait_blocked(&t_tid[i]) != 0){
+            printf("thread %d does not wait for the lock!\n", i);
+            passed = false;
+        }
+    }
+    if(n_in != r_hold){
+        printf("a thread gets in beside the readers' writer!\n");
+        passed = false;
+    }
+    hold = 0;
+    for(int i = 0; i < t_num; i++){
+        pthread_join(th[i], NULL);
+    }
+    if(order[0] != 4 || order[1] != 5){
+        printf("the writer and the late reader get in out of turn!\n");
+        passed = false;
+    }
+
+    pin(0);
+    rwl_rlock(&rwlock);
+    pin(-1 + (int)sysconf(_SC_NPROCESSORS_ONLN));
+    if(rwl_trywlock(&rwlock, 0) != EBUSY){
+        printf("a writer gets in beside a migrated reader!\n");
+        passed = false;
+    }
+    rwl_runlock(&rwlock);
+    if(rwl_trywlock(&rwlock, 0) != 0){
+        printf("a reader released on another CPU is still counted!\n");
+        passed = false;
+    }else{
+        rwl_wunlock(&rwlock, 0);
+    }
+
+    for(int i = 0; i < 4; i++){
+        id[i] = i;
+        pthread_create(&th[i], NULL, i < 2 ? &hammer_write : &hammer_read,
+            &id[i]);
+    }
+    for(int i = 0; i < 4; i++){
+        pthread_join(th[i], NULL);
+    }
+    if(torn || a != 2 * ROUNDS){
+        printf("writes are torn or lost: %ld of %d!\n", a, 2 * ROUNDS);
+        passed = false;
+    }
+    rwl_destroy(&rwlock);
+
+    if(passed == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/syscall.h>
+#define gettid() syscall(SYS_gettid)
+
+#include "rwlock.h"
+#include "test_common.h"
+
+typedef enum{true, false} bool;
+
+/*
+combined write tests seq:
+Main combines a write with nobody around: it has run when the call returns
+Main takes write
+Writer 0 (priority 2), Writer 1 (priority 1), Writer 2 (priority 0) and
+    Writer 3 (priority 1) post writes one at a time and wait
+Main releases the write: Main itself runs the posted writes, those of
+    Writers 2, 1, 3 and 0 in that order
+Writers 0-3 each combine ROUNDS increments of a plain counter: none is lost
+Main takes write
+Posters 0-99 (priority 1) post writes one at a time and wait
+Main releases the write: it runs some of them but lets go before the last,
+    and the rest still run, in the order they were posted
+*/
+
+#define t_num 4
+#define ROUNDS 20000
+#define p_num 100
+
+rwl rwlock;
+int t_prior[t_num] = {2, 1, 0, 1};
+volatile int t_tid[p_num];
+int order[p_num];
+int runner[p_num];
+int n_done;
+long counter;
+
+void record(void *arg) {
+    int id = *(int *)arg;
+    runner[n_done] = gettid();
+    order[n_done++] = id;
+}
+
+void increment(void *arg) {
+    counter++;
+}
+
+void * worker(void* args) {
+    int id = *(int *)args;
+    t_tid[id] = gettid();
+    rwl_combine(&rwlock, t_prior[id], &record, &id);
+    pthread_exit(NULL);
+}
+
+void * poster(void* args) {
+    int id = *(int *)args;
+    t_tid[id] = gettid();
+    rwl_combine(&rwlock, 1, &record, &id);
+    pthread_exit(NULL);
+}
+
+void * adder(void* args) {
+    int id = *(int *)args;
+    for(int i = 0; i < ROUNDS; i++){
+        rwl_combine(&rwlock, t_prior[id], &increment, NULL);
+    }
+    pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[]) {
+    int expected[t_num] = {2, 1, 3, 0};
+    pthread_t th[p_num];
+    int id[p_num];
+    bool passed = true;
+
+    printf("combined write test:\n");
+    rwl_init(&rwlock);
+
+    rwl_combine(&rwlock, 1, &increment, NULL);
+    if(counter != 1){
+        printf("combined write has not run on return!\n");
+        passed = false;
+    }
+
+    rwl_wlock(&rwlock, 0);
+    for(int i = 0; i < t_num; i++){
+        id[i] = i;
+        if(pthread_create(&th[i], NULL, &worker, &id[i]) != 0){
+            printf("Failed to create threads!\n");
+            return 0;
+        }
+        if(wait_blocked(&t_tid[i]) != 0){
+            printf("thread %d does not wait for its write!\n", i);
+            passed = false;
+        }
+    }
+    rwl_wunlock(&rwlock, 0);
+    if(n_done != t_num){
+        printf("posted writes are not run by the lock holder!\n");
+        passed = false;
+    }
+    for(int i = 0; i < t_num; i++){
+        pthread_join(th[i], NULL);
+    }
+    for(int i = 0; i < t_num; i++){
+        if(order[i] != expected[i]){
+            printf("write of thread %d runs out of turn!\n", order[i]);
+            passed = false;
+        }
+        if(runner[i] != gettid()){
+            printf("write of thread %d runs on its own thread!\n",
+                order[i]);
+            passed = false;
+        }
+    }
+
+    counter = 0;
+    for(int i = 0; i < t_num; i++){
+        pthread_create(&th[i], NULL, &adder, &id[i]);
+    }
+    for(int i = 0; i < t_num; i++){
+        pthread_join(th[i], NULL);
+    }
+    if(counter != (long)t_num * ROUNDS){
+        printf("combined writes are lost: %ld of %d!\n", counter,
+            t_num * ROUNDS);
+        passed = false;
+    }
+
+    n_done = 0;
+    rwl_wlock(&rwlock, 0);
+    for(int i = 0; i < p_num; i++){
+        id[i] = i;
+        t_tid[i] = 0;
+        if(pthread_create(&th[i], NULL, &poster, &id[i]) != 0){
+            printf("Failed to create threads!\n");
+            return 0;
+        }
+        if(wait_blocked(&t_tid[i]) != 0){
+            printf("poster %d does not wait for its write!\n", i);
+            passed = false;
+        }
+    }
+    rwl_wunlock(&rwlock, 0);
+    if(n_done == 0 || n_done == p_num){
+        printf("one unlock runs %d of %d posted writes!\n", n_done, p_num);
+        passed = false;
+    }
+    for(int i = 0; i < p_num; i++){
+        pthread_join(th[i], NULL);
+    }
+    for(int i = 0; i < p_num; i++){
+        if(order[i] != i){
+            printf("posted writes do not run in order, %d at %d!\n",
+                order[i], i);
+            passed = false;
+            break;
+        }
+    }
+    rwl_destroy(&rwlock);
+
+    if(passed == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+#ifndef TEST_COMMON_H
+#define TEST_COMMON_H
+
+#include <unistd.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#include "rwlock.h"
+
+/*
+waiting for a test thread to block in a lock:
+wait_blocked(&tid) waits, up to BLOCK_MS of wall time, for tid to be set
+and then for that thread or process to block, and returns 0, or ETIMEDOUT.
+A test built with -DRWL_TRACE learns it from rwl_trace_hook, installed
+before main, as soon as an rwl has queued the thread (RWL_TRACE_WAIT).
+Otherwise the thread's state is read out of /proc until it is sleeping,
+which works for any lock and means the thread is really off the CPU.
+*/
+
+#define BLOCK_MS 1000
+
+static inline long long test_now_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ll + ts.tv_nsec / 1000000;
+}
+
+#ifdef RWL_TRACE
+#define TRACE_SLOTS 64
+
+/* threads an rwl has queued and not yet let in */
+static volatile int trace_waiting[TRACE_SLOTS];
+
+static void trace_waits(rwl *l, int event, int priority){
+    int tid = (int)syscall(SYS_gettid);
+    int from = event == RWL_TRACE_WAIT ? 0 : tid;
+    int to = event == RWL_TRACE_WAIT ? tid : 0;
+    if(event == RWL_TRACE_RELEASE){
+        return;
+    }
+    for(int i = 0; i < TRACE_SLOTS; i++){
+        int cur = from;
+        if(trace_waiting[i] == from &&
+            __atomic_compare_exchange_n(&trace_waiting[i], &cur, to, 0,
+            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)){
+            return;
+        }
+    }
+}
+
+__attribute__((constructor)) static void trace_install(void){
+    rwl_trace_hook = trace_waits;
+}
+
+static int tid_blocked(int tid){
+    for(int i = 0; i < TRACE_SLOTS; i++){
+        if(__atomic_load_n(&trace_waiting[i], __ATOMIC_SEQ_CST) == tid){
+            return 1;
+        }
+    }
+    return 0;
+}
+#else
+static int tid_blocked(int tid){
+    char path[64], buf[256];
+    char *state = NULL;
+    FILE *fp;
+    snprintf(path, sizeof(path), "/proc/%d/stat", tid);
+    if((fp = fopen(path, "r")) == NULL){
+        return 0;
+    }
+    if(fgets(buf, sizeof(buf), fp) != NULL){
+        state = strrchr(buf, ')');
+    }
+    fclose(fp);
+    return state != NULL && state[2] == 'S';
+}
+#endif
+
+static int wait_blocked(volatile int *tid){
+    long long deadline = test_now_ms() + BLOCK_MS;
+    while(test_now_ms() < deadline){
+        if(*tid != 0 && tid_blocked(*tid)){
+            return 0;
+        }
+#ifdef RWL_TRACE
+        sched_yield();
+#else
+        usleep(1000);
+#endif
+    }
+    return ETIMEDOUT;
+}
+
+#endif
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "rwlock_coro.hpp"
+
+/*
+coroutine lock tests seq, all on Main's thread unless said otherwise:
+Main takes write
+Writer 0 (priority 2), Reader 0, Writer 1 (priority 1) and Writer 2
+    (priority 0) co_await the lock and are suspended; Main goes on
+Main releases the write: Writers 2, 1 and 0, then Reader 0, run in that
+    order, each handed the lock by the one before it
+Main takes read, Writer 0 co_awaits write and Reader 0 read: both suspended,
+    Reader 0 kept out by the queued writer
+Main releases the read: Writer 0 runs, then Reader 0
+Main takes write, Writers 0 to CHAIN-1 co_await write and are suspended
+Main releases the write: they all run in turn, every one as deep in the
+    stack as the first, none resumed from inside another's release
+Main takes write, Writer 0 co_awaits write with an executor: Main's release
+    posts it there, and it runs when the executor does
+Threads 0-3 each run an executor and a coroutine on it that writes ROUNDS
+    times, Thread i at priority i % 3, posted back to it when suspended;
+    Threads 4-5 do the same with one that reads ROUNDS times, resumed by
+    whoever releases to it: readers never see a write half done and no
+    write is lost
+*/
+
+#define t_num 4
+#define ROUNDS 20000
+#define CHAIN 1000
+
+// task is a coroutine that starts at once and cleans up after itself
+struct task {
+    struct promise_type {
+        task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// manual_executor runs what is posted to it when told to
+struct manual_executor {
+    std::deque<std::coroutine_handle<>> q;
+    void post(std::coroutine_handle<> h) { q.push_back(h); }
+    void run() {
+        while(!q.empty()){
+            auto h = q.front();
+            q.pop_front();
+            h.resume();
+        }
+    }
+};
+
+rwlock::co_rwl<> lock;
+std::vector<int> order;
+
+task writer(int id, int priority) {
+    auto w = co_await lock.write(priority);
+    order.push_back(id);
+}
+
+task reader(int id) {
+    auto r = co_await lock.read();
+    order.push_back(100 + id);
+}
+
+// where the stack is, in whatever function calls this
+__attribute__((noinline)) uintptr_t stack_at() {
+    return (uintptr_t)__builtin_frame_address(0);
+}
+
+std::vector<uintptr_t> depth;
+
+task chained_writer(int id) {
+    auto w = co_await lock.write(0);
+    order.push_back(id);
+    depth.push_back(stack_at());
+}
+
+task posted_writer(int id, manual_executor &ex) {
+    auto w = co_await lock.write(0, ex);
+    order.push_back(id);
+}
+
+bool in_order(const std::vector<int> &expected) {
+    if(order != expected){
+        printf("coroutines get the lock out of turn:");
+        for(int id : order){
+            printf(" %d", id);
+        }
+        printf("!\n");
+        return false;
+    }
+    return true;
+}
+
+// thread_executor is run by one thread and posted to from any
+struct thread_executor {
+    std::mutex m;
+    std::deque<std::coroutine_handle<>> q;
+    void post(std::coroutine_handle<> h) {
+        std::lock_guard<std::mutex> g(m);
+        q.push_back(h);
+    }
+    // run what comes until done says so
+    template <class Done>
+    void run(Done done) {
+        while(!done()){
+            std::coroutine_handle<> h;
+            {
+                std::lock_guard<std::mutex> g(m);
+                if(!q.empty()){
+                    h = q.front();
+                    q.pop_front();
+                }
+            }
+            if(h){
+                h.resume();
+            }else{
+                std::this_thread::yield();
+            }
+        }
+    }
+};
+
+rwlock::co_rwl<> hlock;
+thread_executor t_ex[t_num];
+long a, b;
+std::atomic<bool> torn;
+std::atomic<int> n_done;
+
+task hammer_write(int priority, thread_executor &ex) {
+    for(int k = 0; k < ROUNDS; k++){
+        auto w = co_await hlock.write(priority, ex);
+        a++;
+        // give the others a chance to queue up behind us
+        std::this_thread::yield();
+        b++;
+    }
+    n_done++;
+}
+
+task hammer_read() {
+    for(int k = 0; k < ROUNDS; k++){
+        auto r = co_await hlock.read();
+        if(a != b){
+            torn = true;
+        }
+    }
+    n_done++;
+}
+
+int main(int argc, char *argv[]) {
+    bool passed = true;
+    manual_executor ex;
+
+    printf("coroutine lock test:\n");
+    if(!lock.try_lock()){
+        printf("Failed to take a free lock!\n");
+        return 0;
+    }
+    writer(0, 2);
+    reader(0);
+    writer(1, 1);
+    writer(2, 0);
+    if(!order.empty()){
+        printf("a coroutine gets in beside a writer!\n");
+        passed = false;
+    }
+    lock.unlock();
+    if(!in_order({2, 1, 0, 100})){
+        passed = false;
+    }
+
+    order.clear();
+    lock.try_lock_shared();
+    writer(0, 1);
+    reader(0);
+    if(!order.empty()){
+        printf("a reader overtakes a queued writer!\n");
+        passed = false;
+    }
+    lock.unlock_shared();
+    if(!in_order({0, 100})){
+        passed = false;
+    }
+
+    order.clear();
+    lock.try_lock();
+    for(int i = 0; i < CHAIN; i++){
+        chained_writer(i);
+    }
+    lock.unlock();
+    if(order.size() != CHAIN){
+        printf("a chain of %d writers stops at %zu!\n", CHAIN, order.size());
+        passed = false;
+    }
+    for(size_t i = 0; i < depth.size(); i++){
+        if(depth[i] != depth[0]){
+            printf("writer %zu is resumed deeper in the stack than writer 0!\n",
+                i);
+            passed = false;
+            break;
+        }
+    }
+
+    order.clear();
+    lock.try_lock();
+    posted_writer(0, ex);
+    lock.unlock();
+    if(!order.empty() || ex.q.size() != 1){
+        printf("a coroutine is resumed instead of posted!\n");
+        passed = false;
+    }
+    ex.run();
+    if(!in_order({0}) || !lock.try_lock()){
+        printf("a posted coroutine does not run or leaks the lock!\n");
+        passed = false;
+    }else{
+        lock.unlock();
+    }
+
+    std::vector<std::thread> th;
+    auto all_done = []{ return n_done.load() == t_num + 2; };
+    for(int i = 0; i < t_num; i++){
+        th.emplace_back([i, all_done]{
+            hammer_write(i % 3, t_ex[i]);
+            t_ex[i].run(all_done);
+        });
+    }
+    for(int i = 0; i < 2; i++){
+        th.emplace_back([]{ hammer_read(); });
+    }
+    for(auto &t : th){
+        t.join();
+    }
+    if(torn || a != (long)t_num * ROUNDS){
+        printf("writes are torn or lost: %ld of %d!\n", a, t_num * ROUNDS);
+        passed = false;
+    }
+
+    if(passed == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+#define gettid() syscall(SYS_gettid)
+
+#include "crwlock.h"
+#include "test_common.h"
+
+typedef enum{true, false} bool;
+
+/*
+cohort lock tests seq, on a lock with two nodes and a batch of two; every
+thread binds itself to a node, and Main to node 0:
+Main takes write (priority 1)
+Writer 0 (node 1), Writers 1-3 (node 0) arrive, all priority 1, and wait
+Main releases the write: Writers 1 and 2 get it from node 0, then the batch
+    is used up and Writer 0 gets it before Writer 3
+Main takes write again
+Writer 0 (node 1, priority 0) and Writer 1 (node 0, priority 1) arrive
+Main releases the write: Writer 0 goes first, no batching past it
+Main takes write again
+Reader 0 (node 1) and Writer 1 (node 0, priority 2) arrive
+Main releases the write: Writer 1 goes first, Reader 0 after it
+*/
+
+#define t_max 4
+
+crwl rwlock;
+const int *t_node;
+const int *t_prior;
+volatile int t_tid[t_max];
+volatile int order[t_max];
+volatile int n_done;
+
+void * worker(void* args) {
+    int id = *(int *)args;
+    crwl_bind(t_node[id]);
+    t_tid[id] = gettid();
+    if(t_prior[id] < 0){
+        crwl_rlock(&rwlock);
+    }else{
+        crwl_wlock(&rwlock, t_prior[id]);
+    }
+    order[__atomic_fetch_add(&n_done, 1, __ATOMIC_SEQ_CST)] = id;
+    usleep(10000);
+    if(t_prior[id] < 0){
+        crwl_runlock(&rwlock);
+    }else{
+        crwl_wunlock(&rwlock, t_prior[id]);
+    }
+    pthread_exit(NULL);
+}
+
+bool run_tests(int t_num, const int *node, const int *prior,
+    const int *expected){
+    pthread_t th[t_max];
+    int id[t_max];
+
+    t_node = node;
+    t_prior = prior;
+    n_done = 0;
+    crwl_wlock(&rwlock, 1);
+    for(int i = 0; i < t_num; i++){
+        id[i] = i;
+        t_tid[i] = 0;
+        if(pthread_create(&th[i], NULL, &worker, &id[i]) != 0){
+            printf("Failed to create threads!\n");
+            return false;
+        }
+        if(wait_blocked(&t_tid[i]) != 0){
+            printf("thread %d does not wait for the lock!\n", i);
+            return false;
+        }
+    }
+    crwl_wunlock(&rwlock, 1);
+    for(int i = 0; i < t_num; i++){
+        pthread_join(th[i], NULL);
+    }
+    for(int i = 0; i < t_num; i++){
+        if(order[i] != expected[i]){
+            printf("thread %d gets the lock out of turn!\n", order[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int batch_node[t_max] = {1, 0, 0, 0};
+    int batch_prior[t_max] = {1, 1, 1, 1};
+    int batch_order[t_max] = {1, 2, 0, 3};
+    int urgent_node[2] = {1, 0};
+    int urgent_prior[2] = {0, 1};
+    int urgent_order[2] = {0, 1};
+    int read_node[2] = {1, 0};
+    int read_prior[2] = {-1, 2};
+    int read_order[2] = {1, 0};
+    bool passed = true;
+
+    printf("cohort lock test:\n");
+    if(crwl_init(&rwlock, 2, 2) != 0){
+        printf("failed to initialize the lock!\n");
+        return 0;
+    }
+    crwl_bind(0);
+    if(run_tests(4, batch_node, batch_prior, batch_order) != true ||
+        run_tests(2, urgent_node, urgent_prior, urgent_order) != true ||
+        run_tests(2, read_node, read_prior, read_order) != true){
+        passed = false;
+    }
+    crwl_destroy(&rwlock);
+    if(crwl_init(&rwlock, 1, -1) != EINVAL){
+        printf("a negative batch is accepted!\n");
+        passed = false;
+    }
+
+    if(passed == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include <unistd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "rwlock.hpp"
+
+/*
+C++ wrapper tests seq:
+std::unique_lock and std::shared_lock take a SharedMutex; while a writer
+    holds it, try_lock_shared fails and try_lock_shared_for gives up after
+    its timeout, from another thread
+A std::lock_guard left by an exception leaves the lock free
+A WriteGuard at the lowest priority writes and unlocks at that priority
+Guarded<std::vector<int>> hands out const views for reading; Writers 0-3
+    each push ROUNDS elements through write views, Writer i at priority
+    i % RWL_LEVELS, while Readers 0-1 check that the size only grows:
+    nothing is lost
+*/
+
+#define t_num 4
+#define ROUNDS 5000
+#define TIMEOUT_MS 20
+
+using namespace std::chrono;
+
+rwlock::SharedMutex rwl_mutex;
+rwlock::Guarded<std::vector<int>> shared_vec;
+
+static_assert(std::is_const<std::remove_reference_t<
+    decltype(*shared_vec.read())>>::value, "read views must be const");
+static_assert(!std::is_const<std::remove_reference_t<
+    decltype(*shared_vec.write())>>::value, "write views must not be");
+
+bool other_thread_reads(bool timed) {
+    bool got = false;
+    std::thread t([&]{
+        if(timed){
+            auto before = steady_clock::now();
+            got = rwl_mutex.try_lock_shared_for(milliseconds(TIMEOUT_MS));
+            if(!got && steady_clock::now() - before <
+                milliseconds(TIMEOUT_MS)){
+                printf("try_lock_shared_for gives up early!\n");
+                got = true;
+            }
+        }else{
+            got = rwl_mutex.try_lock_shared();
+        }
+        if(got){
+            rwl_mutex.unlock_shared();
+        }
+    });
+    t.join();
+    return got;
+}
+
+int main(int argc, char *argv[]) {
+    bool passed = true;
+
+    printf("C++ wrapper test:\n");
+    {
+        std::unique_lock<rwlock::SharedMutex> w(rwl_mutex);
+        if(other_thread_reads(false) || other_thread_reads(true)){
+            printf("a reader gets in beside a std::unique_lock!\n");
+            passed = false;
+        }
+    }
+    {
+        std::shared_lock<rwlock::SharedMutex> r(rwl_mutex);
+        if(!other_thread_reads(false) ||
+            !rwl_mutex.try_lock_shared_until(steady_clock::now())){
+            printf("readers do not share a std::shared_lock!\n");
+            passed = false;
+        }else{
+            rwl_mutex.unlock_shared();
+        }
+        if(rwl_mutex.try_lock_for(milliseconds(1))){
+            printf("a writer gets in beside a std::shared_lock!\n");
+            passed = false;
+        }
+    }
+
+    try{
+        std::lock_guard<rwlock::SharedMutex> w(rwl_mutex);
+        throw std::runtime_error("oops");
+    }catch(const std::runtime_error &){
+    }
+    if(!rwl_mutex.try_lock()){
+        printf("an exception leaks the lock!\n");
+        passed = false;
+    }else{
+        rwl_mutex.unlock();
+    }
+
+    {
+        rwlock::WriteGuard w(rwl_mutex, RWL_LEVELS - 1);
+        if(rwl_mutex.native_handle()->w_active[RWL_LEVELS - 1] != 1){
+            printf("WriteGuard writes at the wrong priority!\n");
+            passed = false;
+        }
+    }
+    if(!rwl_mutex.try_lock()){
+        printf("WriteGuard leaks the lock!\n");
+        passed = false;
+    }else{
+        rwl_mutex.unlock();
+    }
+
+    std::vector<std::thread> th;
+    bool shrunk = false;
+    for(int i = 0; i < t_num; i++){
+        th.emplace_back([i]{
+            for(int k = 0; k < ROUNDS; k++){
+                shared_vec.write(i % RWL_LEVELS)->push_back(k);
+            }
+        });
+    }
+    for(int i = 0; i < 2; i++){
+        th.emplace_back([&shrunk]{
+            size_t last = 0;
+            for(int k = 0; k < ROUNDS; k++){
+                auto v = shared_vec.read();
+                if(v->size() < last){
+                    shrunk = true;
+                }
+                last = v->size();
+            }
+        });
+    }
+    for(auto &t : th){
+        t.join();
+    }
+    if(shrunk || shared_vec.read()->size() != (size_t)t_num * ROUNDS){
+        printf("writes through Guarded are lost: %zu of %d!\n",
+            shared_vec.read()->size(), t_num * ROUNDS);
+        passed = false;
+    }
+
+    if(passed == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+#define gettid() syscall(SYS_gettid)
+
+#include "rwlock.h"
+#include "test_common.h"
+
+typedef enum{true, false} bool;
+
+/*
+reader drain tests seq, on a RWL_STATS lock:
+Main takes read
+Writer 0 (priority 1) arrives and waits for Main to leave
+Readers 0-2 arrive and wait behind Writer 0
+Main releases the read: Writer 0 gets the lock, and Readers 0-2 are not
+    woken at all (with futexes, not even scheduled), let alone for nothing
+Writer 0 releases: Readers 0-2 get in, each at its first wakeup
+*/
+
+#define t_num 4
+
+rwl rwlock;
+int t_prior[t_num] = {1, -1, -1, -1};
+volatile int t_tid[t_num];
+volatile int n_in;
+volatile int hold;
+
+void * worker(void* args) {
+    int id = *(int *)args;
+    t_tid[id] = gettid();
+    if(t_prior[id] < 0){
+        rwl_rlock(&rwlock);
+    }else{
+        rwl_wlock(&rwlock, t_prior[id]);
+    }
+    __atomic_fetch_add(&n_in, 1, __ATOMIC_SEQ_CST);
+    if(t_prior[id] < 0){
+        rwl_runlock(&rwlock);
+    }else{
+        while(hold){
+            usleep(1000);
+        }
+        rwl_wunlock(&rwlock, t_prior[id]);
+    }
+    pthread_exit(NULL);
+}
+
+/* how many times the thread has gone to sleep, or -1 */
+long switches(int id){
+    char path[64], line[128];
+    long n = -1;
+    snprintf(path, sizeof(path), "/proc/self/task/%d/status", t_tid[id]);
+    FILE *fp = fopen(path, "r");
+    if(fp == NULL){
+        return -1;
+    }
+    while(fgets(line, sizeof(line), fp) != NULL){
+        if(sscanf(line, "voluntary_ctxt_switches: %ld", &n) == 1){
+            break;
+        }
+    }
+    fclose(fp);
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    pthread_t th[t_num];
+    int id[t_num];
+    long before[t_num];
+    rwl_attr attr;
+    rwl_stats st;
+    bool passed = true;
+
+    printf("reader drain test:\n");
+    rwl_attr_init(&attr);
+    attr.flags = RWL_STATS;
+    if(rwl_init_attr(&rwlock, &attr) != 0){
+        printf("failed to initialize the lock!\n");
+        return 0;
+    }
+    hold = 1;
+    rwl_rlock(&rwlock);
+    for(int i = 0; i < t_num; i++){
+        id[i] = i;
+        if(pthread_create(&th[i], NULL, &worker, &id[i]) != 0){
+            printf("Failed to create threads!\n");
+            return 0;
+        }
+        if(wait_blocked(&t_tid[i]) != 0){
+            printf("thread %d does not wait for the lock!\n", i);
+            passed = false;
+        }
+    }
+    for(int i = 1; i < t_num; i++){
+        before[i] = switches(i);
+    }
+    rwl_runlock(&rwlock);
+    while(n_in == 0){
+        usleep(1000);
+    }
+    usleep(10000);
+    rwl_stats_get(&rwlock, &st);
+    if(n_in != 1 || st.read.spurious != 0){
+        printf("the last reader out wakes the parked readers!\n");
+        passed = false;
+    }
+#ifdef RWL_FUTEX
+    for(int i = 1; i < t_num; i++){
+        if(switches(i) != before[i]){
+            printf("reader %d is scheduled while the writer holds the lock!\n",
+                i - 1);
+            passed = false;
+        }
+    }
+#endif
+    hold = 0;
+    for(int i = 0; i < t_num; i++){
+        pthread_join(th[i], NULL);
+    }
+    rwl_stats_get(&rwlock, &st);
+    if(n_in != t_num || st.read.spurious != 0){
+        printf("readers are woken before the writer leaves!\n");
+        passed = false;
+    }
+    rwl_destroy(&rwlock);
+
+    if(passed == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include <unistd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include "rwlock.h"
+
+typedef enum{true, false} bool;
+
+/*
+fast path tests seq, with Main holding the lock's own mutex throughout, so
+that anything but the single atomic state word would hang:
+Worker 0 takes read three times, all held together, and releases them
+Worker 0 takes write (priority 1) and releases it
+Worker 0 takes read again after the writer and releases it
+Worker 0 tries read and write (priority 0): both succeed
+Main waits up to WAIT_MS and releases the mutex: Worker 0 was done
+    before that
+*/
+
+#define WAIT_MS 1000
+
+rwl rwlock;
+volatile int done;
+
+void * worker(void* args) {
+    rwl_rlock(&rwlock);
+    rwl_rlock(&rwlock);
+    rwl_rlock(&rwlock);
+    for(int i = 0; i < 3; i++){
+        rwl_runlock(&rwlock);
+    }
+    rwl_wlock(&rwlock, 1);
+    rwl_wunlock(&rwlock, 1);
+    rwl_rlock(&rwlock);
+    rwl_runlock(&rwlock);
+    if(rwl_tryrlock(&rwlock) == 0){
+        rwl_runlock(&rwlock);
+        if(rwl_trywlock(&rwlock, 0) == 0){
+            rwl_wunlock(&rwlock, 0);
+            done = 1;
+        }
+    }
+    pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[]) {
+    pthread_t th;
+    bool passed = true;
+
+    printf("fast path test:\n");
+    rwl_init(&rwlock);
+    pthread_mutex_lock(&rwlock.mutex);
+    if(pthread_create(&th, NULL, &worker, NULL) != 0){
+        printf("Failed to create threads!\n");
+        return 0;
+    }
+    for(int i = 0; i < WAIT_MS && done == 0; i++){
+        usleep(1000);
+    }
+    if(done != 1){
+        printf("an uncontended lock or unlock needs the mutex!\n");
+        passed = false;
+    }
+    pthread_mutex_unlock(&rwlock.mutex);
+    pthread_join(th, NULL);
+    rwl_destroy(&rwlock);
+
+    if(passed == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+#define gettid() syscall(SYS_gettid)
+
+#include "rwlock.h"
+#include "test_common.h"
+
+typedef enum{true, false} bool;
+
+/*
+handoff tests seq, with Writer 0 SCHED_IDLE and on Main's CPU, so that it
+only runs while Main sleeps:
+Main takes write (priority 0)
+Writer 0 (priority 0) arrives and waits
+Main releases and at once takes write again: Writer 0 is only woken, and
+    Main barges in ahead of it
+Writer 0 runs, finds the lock taken and goes back to sleep, passed over
+Main releases and at once takes write again: this time the lock is handed
+    to Writer 0 before it even runs, and Main only gets back in after it
+The same on a RWL_FIFO lock: Writer 0 is handed the lock on the first
+    release already, and Main only gets back in after it
+*/
+
+#define t_num 1
+
+rwl rwlock;
+cpu_set_t cpu;
+volatile int t_tid[t_num];
+volatile int got;
+
+void * worker(void* args) {
+    int id = *(int *)args;
+    struct sched_param param = { .sched_priority = 0 };
+
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu);
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    t_tid[id] = gettid();
+    rwl_wlock(&rwlock, 0);
+    got = 1;
+    rwl_wunlock(&rwlock, 0);
+    pthread_exit(NULL);
+}
+
+/* wait up to a second for Writer 0 to have been woken for nothing */
+bool passed_over(void){
+    rwl_stats st;
+    for(int i = 0; i < 1000; i++){
+        rwl_stats_get(&rwlock, &st);
+        if(st.write[0].spurious > 0){
+            return true;
+        }
+        usleep(1000);
+    }
+    return false;
+}
+
+bool run_tests(unsigned int flags){
+    pthread_t th;
+    int id = 0;
+    rwl_attr attr;
+    bool passed = true;
+
+    rwl_attr_init(&attr);
+    attr.flags = RWL_STATS | flags;
+    if(rwl_init_attr(&rwlock, &attr) != 0){
+        printf("failed to initialize the lock!\n");
+        return false;
+    }
+    got = 0;
+    t_tid[id] = 0;
+    rwl_wlock(&rwlock, 0);
+    if(pthread_create(&th, NULL, &worker, &id) != 0){
+        printf("Failed to create threads!\n");
+        return false;
+    }
+    if(wait_blocked(&t_tid[id]) != 0){
+        printf("writer 0 does not wait for the lock!\n");
+        passed = false;
+    }
+    if((flags & RWL_FIFO) == 0){
+        rwl_wunlock(&rwlock, 0);
+        rwl_wlock(&rwlock, 0);
+        if(got != 0){
+            printf("a woken writer gets in ahead of a running one!\n");
+            passed = false;
+        }
+        if(passed_over() != true || wait_blocked(&t_tid[id]) != 0){
+            printf("writer 0 does not go back to sleep when passed over!\n");
+            passed = false;
+        }
+    }
+    rwl_wunlock(&rwlock, 0);
+    rwl_wlock(&rwlock, 0);
+    if(got != 1){
+        printf("a queued writer is not handed the lock!\n");
+        passed = false;
+    }
+    rwl_wunlock(&rwlock, 0);
+    pthread_join(th, NULL);
+    rwl_destroy(&rwlock);
+    return passed;
+}
+
+int main(int argc, char *argv[]) {
+    bool passed = true;
+
+    printf("handoff test:\n");
+    CPU_ZERO(&cpu);
+    CPU_SET(sched_getcpu(), &cpu);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu);
+    if(run_tests(0) != true || run_tests(RWL_FIFO) != true){
+        passed = false;
+    }
+
+    if(passed == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
@@ -0,0 +1,417 @@
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "rwlock.h"
+
+typedef enum{true, false} bool;
+
+/*
+deterministic harness:
+The other tests find out that a thread is waiting for the lock by reading its
+state out of /proc, which takes milliseconds a step.  This one is built with
+-DRWL_TRACE and learns it from rwl_trace_hook instead, as it happens.
+
+A pool of actor threads takes commands from Main: R (read lock), r (read
+unlock), W (write lock) and w (write unlock).  The hook marks an actor as
+waiting or holding, and an actor marks itself idle once its unlock returns.
+After each step Main waits for every actor to reach the state a model of the
+lock predicts, and gives up on the lock after a few seconds:
+    a reader gets in unless a writer holds the lock or waits for it
+    a writer gets in only if the lock is free
+    writers are handed the lock highest priority first, in arrival order
+        within a priority; readers only when no writer is left waiting
+    except that on a RWL_BIGREADER lock the first writer to come while
+        only readers are in goes next, whatever its priority
+The hook also checks that nobody shares the lock with a writer, and makes
+actors yield at random so each run interleaves differently.
+
+Each round plays the five sequences of test_basicread, test_basicwrite,
+test_prioritywrite, test_basicrw and test_priorityrw, then a random one in
+which several actors may be told to go at once where the outcome does not
+depend on who is first.  Rounds cycle through the lock flavours that follow
+these rules (RWL_PHASE_FAIR does not); RWL_BIGREADER rounds only play the
+random walk, as the sequences assume the plain writer order.
+
+    ./test_harness [rounds] [seed]
+*/
+
+#define ACTORS 12
+#define RANDOM_STEPS 40
+#define TIMEOUT_S 5
+
+enum {IDLE, WAITING, HOLDING};
+
+typedef struct {
+    const char *name;
+    int r_num;
+    int w_prior[9];
+    int w_num;
+    const char *seq;    /* Rn/rn: reader n, Wn/wn: writer n */
+} scenario;
+
+scenario scenarios[] = {
+    {"basicread", 4, {0}, 0, "R0 R3 R1 r0 R2 r1 r2 r3"},
+    {"basicwrite", 0, {0, 0, 0}, 3, "W1 W0 W2 w1 w0 w2"},
+    {"prioritywrite", 0, {0, 1, 2}, 3, "W1 W0 W2 w1 W1 w0 w1 w2"},
+    {"basicrw", 2, {0, 0}, 2, "W0 W1 R0 w0 w1 R1 r0 W0 R0 r1 w0 r0"},
+    {"priorityrw", 3, {0, 0, 0, 1, 1, 1, 2, 2, 2}, 9,
+        "W1 W0 W3 W7 R0 w1 w0 R1 w3 W8 w7 w8 W6 R2 W4 W5 r1 r0 W2 R1 "
+        "w4 w2 w5 w6 r2 r1"},
+};
+
+int flavours[] = {0, RWL_ADAPTIVE, RWL_BIGREADER, RWL_STATS};
+
+rwl rwlock;
+pthread_mutex_t h_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t h_cond = PTHREAD_COND_INITIALIZER;
+pthread_cond_t a_cond[ACTORS];
+unsigned int h_seed;
+char cmd[ACTORS];
+int cmd_prior[ACTORS];
+volatile int state[ACTORS];  /* what the actors report */
+int n_readers, n_writers;
+bool shared = false;
+__thread int me = -1;
+
+/* the model: what each actor should be doing */
+int want[ACTORS];
+int writing[ACTORS];
+int prior[ACTORS];
+unsigned long arrival[ACTORS];
+unsigned long n_arrivals;
+int bigreader;
+int drainer = -1;  /* RWL_BIGREADER writer waiting out the readers */
+
+void hook(rwl *l, int event, int priority) {
+    int yield;
+    if(me < 0){
+        return;
+    }
+    pthread_mutex_lock(&h_mutex);
+    if(event == RWL_TRACE_WAIT){
+        state[me] = WAITING;
+    }else if(event == RWL_TRACE_ACQUIRE){
+        if(n_writers > 0 || (priority >= 0 && n_readers > 0)){
+            shared = true;
+        }
+        if(priority >= 0){
+            n_writers++;
+        }else{
+            n_readers++;
+        }
+        state[me] = HOLDING;
+    }else if(priority >= 0){
+        n_writers--;
+    }else{
+        n_readers--;
+    }
+    yield = rand_r(&h_seed) % 4 == 0;
+    pthread_cond_signal(&h_cond);
+    pthread_mutex_unlock(&h_mutex);
+    if(yield){
+        sched_yield();
+    }
+}
+
+void * actor(void* args) {
+    me = *(int *)args;
+    for(;;){
+        char c;
+        int p, yield;
+        pthread_mutex_lock(&h_mutex);
+        while(cmd[me] == 0){
+            pthread_cond_wait(&a_cond[me], &h_mutex);
+        }
+        c = cmd[me];
+        p = cmd_prior[me];
+        cmd[me] = 0;
+        yield = rand_r(&h_seed) % 2 == 0;
+        pthread_mutex_unlock(&h_mutex);
+        if(yield){
+            sched_yield();
+        }
+        if(c == 'q'){
+            break;
+        }else if(c == 'R'){
+            rwl_rlock(&rwlock);
+        }else if(c == 'W'){
+            rwl_wlock(&rwlock, p);
+        }else{
+            if(c == 'r'){
+                rwl_runlock(&rwlock);
+            }else{
+                rwl_wunlock(&rwlock, p);
+            }
+            pthread_mutex_lock(&h_mutex);
+            state[me] = IDLE;
+            pthread_cond_signal(&h_cond);
+            pthread_mutex_unlock(&h_mutex);
+        }
+    }
+    pthread_exit(NULL);
+}
+
+void command(int a, char c, int p) {
+    pthread_mutex_lock(&h_mutex);
+    cmd[a] = c;
+    cmd_prior[a] = p;
+    pthread_cond_signal(&a_cond[a]);
+    pthread_mutex_unlock(&h_mutex);
+}
+
+int count(int s, int w) {
+    int n = 0;
+    for(int a = 0; a < ACTORS; a++){
+        if(want[a] == s && writing[a] == w){
+            n++;
+        }
+    }
+    return n;
+}
+
+/* the model's take on actor a asking for the lock */
+void model_lock(int a, int w, int p) {
+    writing[a] = w;
+    prior[a] = p;
+    arrival[a] = n_arrivals++;
+    if(w){
+        want[a] = count(HOLDING, 0) + count(HOLDING, 1) > 0 ?
+            WAITING : HOLDING;
+        if(bigreader && want[a] == WAITING &&
+            count(HOLDING, 1) + count(WAITING, 1) == 1){
+            drainer = a;
+        }
+    }else{
+        want[a] = count(HOLDING, 1) + count(WAITING, 1) > 0 ?
+            WAITING : HOLDING;
+    }
+}
+
+/* and on actor a letting go of it */
+void model_unlock(int a) {
+    int next = -1;
+    want[a] = IDLE;
+    if(count(HOLDING, 0) + count(HOLDING, 1) > 0){
+        return;
+    }
+    if(drainer >= 0){
+        want[drainer] = HOLDING;
+        drainer = -1;
+        return;
+    }
+    for(int b = 0; b < ACTORS; b++){
+        if(want[b] == WAITING && writing[b] && (next < 0 ||
+            prior[b] < prior[next] ||
+            (prior[b] == prior[next] && arrival[b] < arrival[next]))){
+            next = b;
+        }
+    }
+    if(next >= 0){
+        want[next] = HOLDING;
+        return;
+    }
+    for(int b = 0; b < ACTORS; b++){
+        if(want[b] == WAITING){
+            want[b] = HOLDING;
+        }
+    }
+}
+
+void step(int a, char c) {
+    if(c == 'R' || c == 'W'){
+        model_lock(a, c == 'W', prior[a]);
+    }else{
+        model_unlock(a);
+    }
+    command(a, c, prior[a]);
+}
+
+/* wait for the actors to do what the model says */
+bool settle(const char *what) {
+    struct timespec deadline;
+    bool ok = true;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += TIMEOUT_S;
+    pthread_mutex_lock(&h_mutex);
+    for(;;){
+        int a = 0;
+        while(a < ACTORS && state[a] == want[a]){
+            a++;
+        }
+        if(shared == true){
+            printf("%s: a writer shares the lock!\n", what);
+            ok = false;
+            break;
+        }
+        if(a == ACTORS){
+            break;
+        }
+        if(pthread_cond_timedwait(&h_cond, &h_mutex, &deadline) ==
+            ETIMEDOUT){
+            printf("%s: actor %d is %d, should be %d\n", what, a, state[a],
+                want[a]);
+            ok = false;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&h_mutex);
+    return ok;
+}
+
+bool play(const scenario *sc) {
+    const char *s = sc->seq;
+    char what[64];
+    while(*s != '\0'){
+        char c = *s;
+        int n = (int)strtol(s + 1, (char **)&s, 10);
+        int a = c == 'R' || c == 'r' ? n : sc->r_num + n;
+        prior[a] = c == 'W' || c == 'w' ? sc->w_prior[n] : -1;
+        step(a, c);
+        snprintf(what, sizeof(what), "%s, %c%d", sc->name, c, n);
+        if(settle(what) != true){
+            return false;
+        }
+        while(*s == ' '){
+            s++;
+        }
+    }
+    return true;
+}
+
+/* a random walk, each step a batch of actors whose order does not matter */
+bool play_random(unsigned int *seed) {
+    char what[64];
+    for(int i = 0; i < RANDOM_STEPS || count(IDLE, 0) + count(IDLE, 1) <
+        ACTORS; i++){
+        int idle[ACTORS], held[ACTORS];
+        int n_idle = 0, n_held = 0, n = 0;
+        for(int a = 0; a < ACTORS; a++){
+            if(want[a] == IDLE){
+                idle[n_idle++] = a;
+            }else if(want[a] == HOLDING){
+                held[n_held++] = a;
+            }
+        }
+        if(n_held > 0 && (i >= RANDOM_STEPS || n_idle == 0 ||
+            rand_r(seed) % 2 == 0)){
+            /* readers can leave together, the last one hands over */
+            int a = held[rand_r(seed) % n_held];
+            if(!writing[a]){
+                for(int b = 0; b < n_held && n < 3; b++){
+                    if(!writing[held[b]] && (held[b] == a ||
+                        rand_r(seed) % 2 == 0)){
+                        step(held[b], 'r');
+                        n++;
+                    }
+                }
+            }else{
+                step(a, 'w');
+                n = 1;
+            }
+        }else{
+            /* with a writer in or waiting everybody queues, and only
+             * writers of the same priority care who came first; with
+             * none, readers all get in and a writer has to go alone */
+            int blocked = count(HOLDING, 1) + count(WAITING, 1) > 0;
+            int taken = 0;
+            int batch = 1 + rand_r(seed) % 3;
+            for(int k = 0; k < batch && n_idle > 0; k++){
+                int j = rand_r(seed) % n_idle;
+                int a = idle[j];
+                int p = rand_r(seed) % (RWL_LEVELS + 1) - 1;
+                if(p >= 0 && (taken & (1 << p)) != 0){
+                    continue;
+                }
+                if(p >= 0 && !blocked){
+                    if(k > 0){
+                        continue;
+                    }
+                    batch = 1;
+                }
+                idle[j] = idle[--n_idle];
+                prior[a] = p;
+                if(p >= 0){
+                    taken |= 1 << p;
+                }
+                step(a, p >= 0 ? 'W' : 'R');
+                n++;
+            }
+        }
+        snprintf(what, sizeof(what), "random, step %d", i);
+        if(settle(what) != true){
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    unsigned int first = argc > 2 ? atoi(argv[2]) : time(NULL);
+    unsigned int seed = first;
+    int n_scenarios = sizeof(scenarios) / sizeof(scenarios[0]);
+    int n_flavours = sizeof(flavours) / sizeof(flavours[0]);
+    pthread_t th[ACTORS];
+    int id[ACTORS];
+    struct timespec t0, t1;
+    long played = 0;
+    bool passed = true;
+
+    printf("harness test:\n");
+    h_seed = seed;
+    rwl_trace_hook = &hook;
+    for(int a = 0; a < ACTORS; a++){
+        id[a] = a;
+        pthread_cond_init(&a_cond[a], NULL);
+        if(pthread_create(&th[a], NULL, &actor, &id[a]) != 0){
+            printf("Failed to create threads!\n");
+            return 0;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(int r = 0; r < rounds && passed == true; r++){
+        rwl_attr attr;
+        rwl_attr_init(&attr);
+        attr.flags = flavours[r % n_flavours];
+        bigreader = attr.flags & RWL_BIGREADER;
+        if(rwl_init_attr(&rwlock, &attr) != 0){
+            printf("failed to initialize the lock!\n");
+            return 0;
+        }
+        for(int i = bigreader ? n_scenarios : 0; i <= n_scenarios &&
+            passed == true; i++){
+            if(i < n_scenarios ? play(&scenarios[i]) != true :
+                play_random(&seed) != true){
+                printf("round %d, flags %#x, seed %u\n", r, attr.flags,
+                    first);
+                passed = false;
+            }
+            played++;
+        }
+        if(passed == true){
+            rwl_destroy(&rwlock);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if(passed == true){
+        for(int a = 0; a < ACTORS; a++){
+            command(a, 'q', 0);
+            pthread_join(th[a], NULL);
+        }
+        double s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        printf("%ld scenarios in %.2fs, %.0f a second\n", played, s,
+            played / s);
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/syscall.h>
+#define gettid() syscall(SYS_gettid)
+
+#include "rwlock.h"
+#include "test_common.h"
+
+typedef enum{true, false} bool;
+
+/*
+levels test seq, built with -DRWL_LEVELS=64:
+Main takes write at priority 0
+Writers with priorities 63, 17, 40, 1, 17, 62 arrive one at a time and sleep
+Main releases the lock
+Writers acquire it in priority order, the two at 17 in arrival order
+Main tries write at priority 63: succeeds
+*/
+
+#define w_num 6
+
+rwl rwlock;
+int w_prior[w_num] = {63, 17, 40, 1, 17, 62};
+int w_expected[w_num] = {3, 1, 4, 2, 5, 0};
+volatile int w_tid[w_num];
+int order[w_num];
+volatile int n_done;
+
+void * writer(void* args) {
+    int id = *(int *)args;
+    w_tid[id] = gettid();
+    rwl_wlock(&rwlock, w_prior[id]);
+    order[n_done] = id;
+    n_done++;
+    rwl_wunlock(&rwlock, w_prior[id]);
+    pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[]) {
+    pthread_t w_th[w_num];
+    int w_id[w_num];
+    bool passed = true;
+
+    printf("levels test:\n");
+    rwl_init(&rwlock);
+    rwl_wlock(&rwlock, 0);
+    for(int i = 0; i < w_num; i++){
+        w_id[i] = i;
+        if(pthread_create(&w_th[i], NULL, &writer, &w_id[i]) != 0){
+            printf("Failed to create threads!\n");
+            return 0;
+        }
+        if(wait_blocked(&w_tid[i]) != 0){
+            printf("Writer %d does not wait for the lock!\n", i);
+            passed = false;
+        }
+    }
+    rwl_wunlock(&rwlock, 0);
+    for(int i = 0; i < w_num; i++){
+        pthread_join(w_th[i], NULL);
+    }
+    for(int i = 0; i < w_num; i++){
+        if(order[i] != w_expected[i]){
+            printf("Writer %d acquires the lock out of priority order!\n",
+                order[i]);
+            passed = false;
+        }
+    }
+    if(rwl_trywlock(&rwlock, 63) != 0){
+        printf("writer fails to try-acquire a free lock!\n");
+        passed = false;
+    }else{
+        rwl_wunlock(&rwlock, 63);
+    }
+    rwl_destroy(&rwlock);
+
+    if(passed == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
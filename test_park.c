@@ -0,0 +1,151 @@
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+#define gettid() syscall(SYS_gettid)
+
+#include "rwlock.h"
+#include "test_common.h"
+
+typedef enum{true, false} bool;
+
+/*
+parking tests seq:
+Main takes write (priority 0)
+Readers 0-3 and Writer 0 (priority 1) arrive and wait
+Main holds the write for PARK_MS: every waiter is asleep in the kernel and
+    uses less than a tenth of that in CPU time meanwhile
+Main releases the write: Writer 0 goes first, then Readers 0-3
+Main takes write, Reader 0 waits with a deadline PARK_MS away: it times out
+    no earlier than that, asleep all the while
+*/
+
+#define t_num 5
+#define PARK_MS 100
+#define MS 1000000ll
+
+rwl rwlock;
+int t_prior[t_num] = {-1, -1, -1, -1, 1};
+volatile int t_tid[t_num];
+volatile int order[t_num];
+volatile int n_done;
+volatile int timed_rc;
+
+void * worker(void* args) {
+    int id = *(int *)args;
+    t_tid[id] = gettid();
+    if(t_prior[id] < 0){
+        rwl_rlock(&rwlock);
+    }else{
+        rwl_wlock(&rwlock, t_prior[id]);
+    }
+    order[__atomic_fetch_add(&n_done, 1, __ATOMIC_SEQ_CST)] = id;
+    if(t_prior[id] < 0){
+        rwl_runlock(&rwlock);
+    }else{
+        rwl_wunlock(&rwlock, t_prior[id]);
+    }
+    pthread_exit(NULL);
+}
+
+void * timed_reader(void* args) {
+    struct timespec deadline;
+    t_tid[0] = gettid();
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += PARK_MS * MS;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec %= 1000000000;
+    timed_rc = rwl_timedrlock(&rwlock, &deadline);
+    pthread_exit(NULL);
+}
+
+/* CPU time the thread has used, in nanoseconds */
+long long cpu_ns(pthread_t th){
+    clockid_t clock;
+    struct timespec ts;
+    if(pthread_getcpuclockid(th, &clock) != 0 ||
+        clock_gettime(clock, &ts) != 0){
+        return -1;
+    }
+    return ts.tv_sec * 1000 * MS + ts.tv_nsec;
+}
+
+long long now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * MS + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+    pthread_t th[t_num];
+    int id[t_num];
+    long long used[t_num];
+    bool passed = true;
+
+    printf("parking test:\n");
+    rwl_init(&rwlock);
+    rwl_wlock(&rwlock, 0);
+    for(int i = 0; i < t_num; i++){
+        id[i] = i;
+        if(pthread_create(&th[i], NULL, &worker, &id[i]) != 0){
+            printf("Failed to create threads!\n");
+            return 0;
+        }
+        if(wait_blocked(&t_tid[i]) != 0){
+            printf("thread %d does not wait for the lock!\n", i);
+            passed = false;
+        }
+    }
+    for(int i = 0; i < t_num; i++){
+        used[i] = cpu_ns(th[i]);
+    }
+    usleep(PARK_MS * 1000);
+    for(int i = 0; i < t_num; i++){
+        if(wait_blocked(&t_tid[i]) != 0 ||
+            cpu_ns(th[i]) - used[i] > PARK_MS * MS / 10){
+            printf("thread %d spins instead of sleeping!\n", i);
+            passed = false;
+        }
+    }
+    rwl_wunlock(&rwlock, 0);
+    for(int i = 0; i < t_num; i++){
+        pthread_join(th[i], NULL);
+    }
+    if(n_done != t_num || order[0] != 4){
+        printf("the waiters do not all get in, the writer first!\n");
+        passed = false;
+    }
+
+    rwl_wlock(&rwlock, 0);
+    t_tid[0] = 0;
+    long long before = now_ns();
+    pthread_create(&th[0], NULL, &timed_reader, NULL);
+    if(wait_blocked(&t_tid[0]) != 0){
+        printf("a timed reader does not wait for the lock!\n");
+        passed = false;
+    }
+    used[0] = cpu_ns(th[0]);
+    usleep(PARK_MS * 1000 / 2);
+    if(cpu_ns(th[0]) - used[0] > PARK_MS * MS / 10){
+        printf("a timed reader spins instead of sleeping!\n");
+        passed = false;
+    }
+    pthread_join(th[0], NULL);
+    if(timed_rc != ETIMEDOUT || now_ns() - before < PARK_MS * MS){
+        printf("a timed reader gives up early or not at all!\n");
+        passed = false;
+    }
+    rwl_wunlock(&rwlock, 0);
+    rwl_destroy(&rwlock);
+
+    if(passed == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
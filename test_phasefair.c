@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+#define gettid() syscall(SYS_gettid)
+
+#include "rwlock.h"
+#include "test_common.h"
+
+typedef enum{true, false} bool;
+
+/*
+phase-fair tests seq, run on a writer-preferring and a phase-fair lock:
+Main takes read
+Writer 0 (priority 1) arrives and waits
+Reader 0 arrives and waits behind Writer 0
+Writer 1 (priority 0) arrives and waits
+Main releases the read: Writer 1 goes first, being the highest priority
+Writer-preferring: Writer 0 goes next, Reader 0 last
+Phase-fair: Reader 0 goes next (the read phase after Writer 1), Writer 0
+    last
+Phase-fair: Main takes write, Reader 0 arrives and waits and is made
+    SCHED_IDLE; Main releases and at once takes the write again, as a lone
+    writer in a loop would: Reader 0 gets in first, even before a trylock
+A big-reader lock cannot be phase-fair: initialization fails
+*/
+
+#define t_num 3
+
+rwl rwlock;
+int t_prior[t_num] = {1, -1, 0};
+volatile int t_tid[t_num];
+volatile int order[t_num];
+volatile int n_done;
+
+void * worker(void* args) {
+    int id = *(int *)args;
+    t_tid[id] = gettid();
+    if(t_prior[id] < 0){
+        rwl_rlock(&rwlock);
+    }else{
+        rwl_wlock(&rwlock, t_prior[id]);
+    }
+    order[__atomic_fetch_add(&n_done, 1, __ATOMIC_SEQ_CST)] = id;
+    usleep(10000);
+    if(t_prior[id] < 0){
+        rwl_runlock(&rwlock);
+    }else{
+        rwl_wunlock(&rwlock, t_prior[id]);
+    }
+    pthread_exit(NULL);
+}
+
+bool run_tests(unsigned int flags, const int *expected){
+    rwl_attr attr;
+    pthread_t th[t_num];
+    int id[t_num];
+
+    rwl_attr_init(&attr);
+    attr.flags = flags;
+    if(rwl_init_attr(&rwlock, &attr) != 0){
+        printf("failed to initialize the lock!\n");
+        return false;
+    }
+    n_done = 0;
+    rwl_rlock(&rwlock);
+    for(int i = 0; i < t_num; i++){
+        id[i] = i;
+        t_tid[i] = 0;
+        if(pthread_create(&th[i], NULL, &worker, &id[i]) != 0){
+            printf("Failed to create threads!\n");
+            return false;
+        }
+        if(wait_blocked(&t_tid[i]) != 0){
+            printf("thread %d does not wait for the lock!\n", i);
+            return false;
+        }
+    }
+    rwl_runlock(&rwlock);
+    for(int i = 0; i < t_num; i++){
+        pthread_join(th[i], NULL);
+    }
+    for(int i = 0; i < t_num; i++){
+        if(order[i] != expected[i]){
+            printf("thread %d gets the lock out of turn!\n", order[i]);
+            return false;
+        }
+    }
+    rwl_destroy(&rwlock);
+    return true;
+}
+
+/* a lone writer looping must not keep a parked reader out */
+bool run_loop_test(void){
+    rwl_attr attr;
+    pthread_t th;
+    int id = 1;
+
+    rwl_attr_init(&attr);
+    attr.flags = RWL_PHASE_FAIR;
+    if(rwl_init_attr(&rwlock, &attr) != 0){
+        printf("failed to initialize the lock!\n");
+        return false;
+    }
+    n_done = 0;
+    t_tid[id] = 0;
+    rwl_wlock(&rwlock, 0);
+    if(pthread_create(&th, NULL, &worker, &id) != 0){
+        printf("Failed to create threads!\n");
+        return false;
+    }
+    if(wait_blocked(&t_tid[id]) != 0){
+        printf("thread %d does not wait for the lock!\n", id);
+        return false;
+    }
+    // the reader is let in by the release itself, before it even runs;
+    // as SCHED_IDLE it cannot run first even on a single CPU
+    struct sched_param param = { .sched_priority = 0 };
+    pthread_setschedparam(th, SCHED_IDLE, &param);
+    rwl_wunlock(&rwlock, 0);
+    bool kept_out = false;
+    if(rwl_trywlock(&rwlock, 0) == 0){
+        kept_out = n_done == 0 ? true : false;
+        rwl_wunlock(&rwlock, 0);
+    }
+    rwl_wlock(&rwlock, 0);
+    if(kept_out == true || n_done != 1){
+        printf("a looping writer keeps a parked reader out!\n");
+        rwl_wunlock(&rwlock, 0);
+        pthread_join(th, NULL);
+        return false;
+    }
+    rwl_wunlock(&rwlock, 0);
+    pthread_join(th, NULL);
+    rwl_destroy(&rwlock);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int writer_first[t_num] = {2, 0, 1};
+    int phase_fair[t_num] = {2, 1, 0};
+    rwl_attr attr;
+    bool passed = true;
+
+    printf("phase-fair test:\n");
+    if(run_tests(0, writer_first) != true ||
+        run_tests(RWL_PHASE_FAIR, phase_fair) != true ||
+        run_loop_test() != true){
+        passed = false;
+    }
+    rwl_attr_init(&attr);
+    attr.flags = RWL_PHASE_FAIR | RWL_BIGREADER;
+    if(rwl_init_attr(&rwlock, &attr) != EINVAL){
+        printf("a phase-fair big-reader lock is accepted!\n");
+        passed = false;
+    }
+
+    if(passed == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
@@ -0,0 +1,167 @@
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#define gettid() syscall(SYS_gettid)
+
+#include "rwlock_policy.hpp"
+#include "test_common.h"
+
+/*
+policy lock tests seq, for several rwl<Policy, Levels, Wait>:
+Writers 0-1 and Readers 0-1 hammer a lock: readers never see a write half
+    done and no write is lost
+WriterPreferred: Main reads, Writer 0 arrives and waits; new readers are
+    kept out until Main releases and Writer 0 is done
+ReaderPreferred: Main reads, Writer 0 arrives and waits; new readers still
+    get in
+Main takes write on a 3 level lock
+Writer 0 (priority 2), Writer 1 (priority 1) and Writer 2 (priority 0)
+    arrive and wait
+Main releases the write: Writers 2, 1 and 0 get it in that order
+*/
+
+#define t_num 3
+#define ROUNDS 20000
+
+using namespace rwlock;
+
+static_assert(sizeof(detail::writer_queue<1>) <
+    sizeof(detail::writer_queue<3>), "one level needs no priority mask");
+
+template <class Lock>
+bool hammer() {
+    Lock l;
+    long a = 0, b = 0;
+    bool torn = false;
+    std::vector<std::thread> th;
+    for(int i = 0; i < 2; i++){
+        th.emplace_back([&]{
+            for(int k = 0; k < ROUNDS; k++){
+                std::unique_lock<Lock> w(l);
+                a++;
+                b++;
+            }
+        });
+        th.emplace_back([&]{
+            for(int k = 0; k < ROUNDS; k++){
+                std::shared_lock<Lock> r(l);
+                if(a != b){
+                    torn = true;
+                }
+            }
+        });
+    }
+    for(auto &t : th){
+        t.join();
+    }
+    if(torn || a != 2 * ROUNDS){
+        printf("writes are torn or lost: %ld of %d!\n", a, 2 * ROUNDS);
+        return false;
+    }
+    return true;
+}
+
+/* does a reader get in while another reads and a writer waits? */
+template <class Lock>
+bool reader_passes_writer() {
+    Lock l;
+    bool passed = false;
+    l.lock_shared();
+    std::thread w([&]{
+        l.lock();
+        l.unlock();
+    });
+    /* give the writer 100ms to queue up and shut readers out */
+    for(int i = 0; i < 100; i++){
+        passed = l.try_lock_shared();
+        if(passed){
+            l.unlock_shared();
+        }
+        if(!passed){
+            break;
+        }
+        usleep(1000);
+    }
+    l.unlock_shared();
+    w.join();
+    return passed;
+}
+
+typedef rwlock::rwl<WriterPreferred, 3, Park> prio_lock;
+prio_lock plock;
+int t_prior[t_num] = {2, 1, 0};
+volatile int t_tid[t_num];
+volatile int order[t_num];
+volatile int n_done;
+
+void * worker(void* args) {
+    int id = *(int *)args;
+    t_tid[id] = gettid();
+    plock.lock(t_prior[id]);
+    order[n_done++] = id;
+    plock.unlock();
+    pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[]) {
+    int expected[t_num] = {2, 1, 0};
+    pthread_t th[t_num];
+    int id[t_num];
+    bool passed = true;
+
+    printf("policy lock test:\n");
+    if(!hammer<rwlock::rwl<>>() ||
+        !hammer<rwlock::rwl<WriterPreferred, 1, Spin>>() ||
+        !hammer<rwlock::rwl<ReaderPreferred, 1, SpinThenPark<100>>>() ||
+        !hammer<rwlock::rwl<ReaderPreferred, 64, Park>>()){
+        passed = false;
+    }
+    if(reader_passes_writer<rwlock::rwl<WriterPreferred, 1, Spin>>() ||
+        reader_passes_writer<rwlock::rwl<WriterPreferred, 3, Park>>()){
+        printf("readers overtake a queued writer!\n");
+        passed = false;
+    }
+    if(!reader_passes_writer<rwlock::rwl<ReaderPreferred, 1, Spin>>() ||
+        !reader_passes_writer<rwlock::rwl<ReaderPreferred, 3, Park>>()){
+        printf("readers are held up by a queued writer!\n");
+        passed = false;
+    }
+
+    plock.lock();
+    for(int i = 0; i < t_num; i++){
+        id[i] = i;
+        if(pthread_create(&th[i], NULL, &worker, &id[i]) != 0){
+            printf("Failed to create threads!\n");
+            return 0;
+        }
+        if(wait_blocked(&t_tid[i]) != 0){
+            printf("thread %d does not wait for the lock!\n", i);
+            passed = false;
+        }
+    }
+    plock.unlock();
+    for(int i = 0; i < t_num; i++){
+        pthread_join(th[i], NULL);
+    }
+    for(int i = 0; i < t_num; i++){
+        if(order[i] != expected[i]){
+            printf("thread %d gets the lock out of turn!\n", order[i]);
+            passed = false;
+        }
+    }
+
+    if(passed == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
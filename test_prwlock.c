@@ -0,0 +1,231 @@
+#include <unistd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "prwlock.h"
+#include "test_common.h"
+
+typedef enum{true, false} bool;
+
+/*
+process-shared lock tests seq, on a lock in a MAP_SHARED mapping:
+Writers 0-1 and Readers 0-1, each a process, hammer the lock: readers never
+    see a write half done and no write is lost
+Writer 0 takes write, tears the data and is killed
+Main reads and then writes: both get EOWNERDEAD, until Main repairs the
+    data and marks it consistent
+Reader 0 takes read and is killed: Main still gets the write
+Main takes write, Writer 0 (priority 0) arrives, waits and is killed
+Main releases the write: Main gets read, and write at priority 2
+Main reads, PRWL_PROCS - 1 Readers read too: one more process gets EAGAIN;
+    once the Readers have gone one more process gets it
+*/
+
+#define ROUNDS 5000
+
+struct shared {
+    prwl l;
+    long a, b;
+    int torn;
+    volatile int hold;
+};
+
+struct shared *sh;
+
+/* fork a process running fn(id), which exits with what fn returns */
+pid_t spawn(int (*fn)(int), int id) {
+    pid_t pid = fork();
+    if(pid == 0){
+        _exit(fn(id));
+    }
+    return pid;
+}
+
+/* wait for pid and return its exit status, or -1 if it was killed */
+int reap(pid_t pid) {
+    int status;
+    if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status)){
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+int hammer_write(int id) {
+    for(int k = 0; k < ROUNDS; k++){
+        if(prwl_wlock(&sh->l, id % RWL_LEVELS) != 0){
+            return 1;
+        }
+        sh->a++;
+        sh->b++;
+        prwl_wunlock(&sh->l, id % RWL_LEVELS);
+    }
+    return 0;
+}
+
+int hammer_read(int id) {
+    for(int k = 0; k < ROUNDS; k++){
+        if(prwl_rlock(&sh->l) != 0){
+            return 1;
+        }
+        if(sh->a != sh->b){
+            sh->torn = 1;
+        }
+        prwl_runlock(&sh->l);
+    }
+    return 0;
+}
+
+int die_writing(int id) {
+    prwl_wlock(&sh->l, 1);
+    sh->a = -1;
+    kill(getpid(), SIGKILL);
+    return 0;
+}
+
+int die_reading(int id) {
+    prwl_rlock(&sh->l);
+    kill(getpid(), SIGKILL);
+    return 0;
+}
+
+int wait_writing(int id) {
+    prwl_wlock(&sh->l, 0);
+    prwl_wunlock(&sh->l, 0);
+    return 0;
+}
+
+int hold_reading(int id) {
+    if(prwl_rlock(&sh->l) != 0){
+        return 1;
+    }
+    while(sh->hold){
+        usleep(1000);
+    }
+    prwl_runlock(&sh->l);
+    return 0;
+}
+
+int try_reading(int id) {
+    int rc = prwl_rlock(&sh->l);
+    if(rc == 0){
+        prwl_runlock(&sh->l);
+    }
+    return rc;
+}
+
+int main(int argc, char *argv[]) {
+    pid_t pid[PRWL_PROCS];
+    bool passed = true;
+    int rc;
+
+    printf("process-shared lock test:\n");
+    sh = mmap(NULL, sizeof(*sh), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(sh == MAP_FAILED || prwl_init(&sh->l) != 0){
+        printf("Failed to set up the shared lock!\n");
+        return 0;
+    }
+
+    for(int i = 0; i < 2; i++){
+        pid[2 * i] = spawn(hammer_write, i);
+        pid[2 * i + 1] = spawn(hammer_read, i);
+    }
+    for(int i = 0; i < 4; i++){
+        if(reap(pid[i]) != 0){
+            printf("process %d fails to take the lock!\n", i);
+            passed = false;
+        }
+    }
+    if(sh->torn || sh->a != 2 * ROUNDS){
+        printf("writes are torn or lost: %ld of %d!\n", sh->a, 2 * ROUNDS);
+        passed = false;
+    }
+
+    reap(spawn(die_writing, 0));
+    if(prwl_rlock(&sh->l) != EOWNERDEAD){
+        printf("a reader is not told the writer died!\n");
+        passed = false;
+    }
+    prwl_runlock(&sh->l);
+    if(prwl_wlock(&sh->l, 2) != EOWNERDEAD){
+        printf("a writer is not told the writer died!\n");
+        passed = false;
+    }
+    sh->a = sh->b;
+    if(prwl_consistent(&sh->l) != 0){
+        printf("the data cannot be marked consistent!\n");
+        passed = false;
+    }
+    prwl_wunlock(&sh->l, 2);
+    if(prwl_wlock(&sh->l, 2) != 0 || prwl_consistent(&sh->l) != EINVAL){
+        printf("the lock stays in doubt after prwl_consistent!\n");
+        passed = false;
+    }
+    prwl_wunlock(&sh->l, 2);
+
+    reap(spawn(die_reading, 0));
+    if(prwl_wlock(&sh->l, 0) != 0){
+        printf("a dead reader holds the lock!\n");
+        passed = false;
+    }
+    prwl_wunlock(&sh->l, 0);
+
+    prwl_wlock(&sh->l, 1);
+    pid[0] = spawn(wait_writing, 0);
+    if(wait_blocked(&pid[0]) != 0){
+        printf("writer 0 does not wait for the lock!\n");
+        passed = false;
+    }
+    kill(pid[0], SIGKILL);
+    reap(pid[0]);
+    prwl_wunlock(&sh->l, 1);
+    if(prwl_rlock(&sh->l) != 0){
+        printf("a reader cannot get past a dead writer!\n");
+        passed = false;
+    }
+    prwl_runlock(&sh->l);
+    if(prwl_wlock(&sh->l, 2) != 0){
+        printf("a writer cannot get past a dead writer!\n");
+        passed = false;
+    }
+    prwl_wunlock(&sh->l, 2);
+
+    prwl_rlock(&sh->l);
+    sh->hold = 1;
+    for(int i = 0; i < PRWL_PROCS - 1; i++){
+        pid[i] = spawn(hold_reading, i);
+    }
+    // the last of them is in once one more finds no room
+    while((rc = reap(spawn(try_reading, 0))) == 0){
+        usleep(1000);
+    }
+    if(rc != EAGAIN){
+        printf("one process too many gets %d, not EAGAIN!\n", rc);
+        passed = false;
+    }
+    sh->hold = 0;
+    for(int i = 0; i < PRWL_PROCS - 1; i++){
+        if(reap(pid[i]) != 0){
+            printf("reader %d fails to take the lock!\n", i);
+            passed = false;
+        }
+    }
+    if(reap(spawn(try_reading, 0)) != 0){
+        printf("the slots of processes gone are not given out again!\n");
+        passed = false;
+    }
+    prwl_runlock(&sh->l);
+    prwl_destroy(&sh->l);
+
+    if(passed == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+#define gettid() syscall(SYS_gettid)
+
+#include "qrwlock.h"
+#include "test_common.h"
+
+typedef enum{true, false} bool;
+
+/*
+queue lock tests seq:
+Main tries read twice: both succeed; tries write: busy
+Main releases both reads, tries write: succeeds; tries read: busy
+Writer 0 (priority 2), Reader 0, Writer 1 (priority 1), Reader 1,
+    Writer 2 (priority 0) and Writer 3 (priority 1) arrive one at a time
+    and wait behind Main
+Main releases the write: Writers 2, 1, 3 and 0 get the lock in that
+    order, then Readers 0 and 1 together
+*/
+
+#define t_num 6
+
+qrwl rwlock;
+int t_prior[t_num] = {2, -1, 1, -1, 0, 1};
+volatile int t_tid[t_num];
+volatile int order[t_num];
+volatile int n_done;
+volatile int r_inside;
+volatile bool r_together = false;
+
+void * worker(void* args) {
+    int id = *(int *)args;
+    t_tid[id] = gettid();
+    if(t_prior[id] < 0){
+        qrwl_rlock(&rwlock);
+        order[__atomic_fetch_add(&n_done, 1, __ATOMIC_SEQ_CST)] = id;
+        // both readers are granted at once, so each sees the other
+        __atomic_fetch_add(&r_inside, 1, __ATOMIC_SEQ_CST);
+        for(int i = 0; i < 1000 && r_inside < 2; i++){
+            usleep(1000);
+        }
+        if(r_inside == 2){
+            r_together = true;
+        }
+        qrwl_runlock(&rwlock);
+    }else{
+        qrwl_wlock(&rwlock, t_prior[id]);
+        order[__atomic_fetch_add(&n_done, 1, __ATOMIC_SEQ_CST)] = id;
+        usleep(1000);
+        qrwl_wunlock(&rwlock, t_prior[id]);
+    }
+    pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[]) {
+    int expected[t_num] = {4, 2, 5, 0};
+    pthread_t th[t_num];
+    int id[t_num];
+    bool passed = true;
+
+    printf("queue lock test:\n");
+    qrwl_init(&rwlock);
+
+    if(qrwl_tryrlock(&rwlock) != 0 || qrwl_tryrlock(&rwlock) != 0){
+        printf("reader fails to try-acquire a free lock!\n");
+        passed = false;
+    }
+    if(qrwl_trywlock(&rwlock, 0) != EBUSY){
+        printf("writer wrongly try-acquires a read-held lock!\n");
+        passed = false;
+    }
+    qrwl_runlock(&rwlock);
+    qrwl_runlock(&rwlock);
+    if(qrwl_trywlock(&rwlock, 1) != 0){
+        printf("writer fails to try-acquire a free lock!\n");
+        passed = false;
+    }
+    if(qrwl_tryrlock(&rwlock) != EBUSY){
+        printf("reader wrongly try-acquires a write-held lock!\n");
+        passed = false;
+    }
+
+    for(int i = 0; i < t_num; i++){
+        id[i] = i;
+        if(pthread_create(&th[i], NULL, &worker, &id[i]) != 0){
+            printf("Failed to create threads!\n");
+            return 0;
+        }
+        if(wait_blocked(&t_tid[i]) != 0){
+            printf("thread %d does not wait for the lock!\n", i);
+            passed = false;
+        }
+    }
+    qrwl_wunlock(&rwlock, 1);
+    for(int i = 0; i < t_num; i++){
+        pthread_join(th[i], NULL);
+    }
+    for(int i = 0; i < 4; i++){
+        if(order[i] != expected[i]){
+            printf("thread %d gets the lock out of turn!\n", order[i]);
+            passed = false;
+        }
+    }
+    if(r_together != true){
+        printf("queued readers are not let in together!\n");
+        passed = false;
+    }
+    qrwl_destroy(&rwlock);
+
+    if(passed == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
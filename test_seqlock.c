@@ -0,0 +1,145 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <sched.h>
+#include <errno.h>
+
+#include "rwlock.h"
+
+typedef enum{true, false} bool;
+
+/*
+optimistic read tests seq:
+Main reads optimistically with nobody around: one pass, no lock taken
+Main starts an optimistic read, Writer 0 takes and releases the lock:
+    Main's read is retried once, under a read lock
+Main takes write and tries read from Reader 0: it goes straight to the
+    read lock and waits for Main
+Writer 0 keeps a pair of values equal while Readers 0-2 read it
+    optimistically: no reader ever returns a torn pair
+*/
+
+#define r_num 3
+#define ROUNDS 100000
+
+rwl rwlock;
+long pair[2];
+volatile int stop;
+volatile int r_state;
+volatile bool torn = false;
+
+void * writer(void* args) {
+    rwl_wlock(&rwlock, 1);
+    rwl_wunlock(&rwlock, 1);
+    pthread_exit(NULL);
+}
+
+void * writer_loop(void* args) {
+    while(!stop){
+        rwl_wlock(&rwlock, 0);
+        __atomic_store_n(&pair[0], pair[0] + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&pair[1], pair[1] + 1, __ATOMIC_RELAXED);
+        rwl_wunlock(&rwlock, 0);
+    }
+    pthread_exit(NULL);
+}
+
+void * reader(void* args) {
+    unsigned int stamp = 0;
+    r_state = 1;
+    do{
+        rwl_oread_begin(&rwlock, &stamp);
+    }while(rwl_oread_retry(&rwlock, &stamp));
+    r_state = 2;
+    pthread_exit(NULL);
+}
+
+void * reader_loop(void* args) {
+    for(int i = 0; i < ROUNDS; i++){
+        unsigned int stamp = 0;
+        long a, b;
+        do{
+            rwl_oread_begin(&rwlock, &stamp);
+            a = __atomic_load_n(&pair[0], __ATOMIC_RELAXED);
+            b = __atomic_load_n(&pair[1], __ATOMIC_RELAXED);
+        }while(rwl_oread_retry(&rwlock, &stamp));
+        if(a != b){
+            torn = true;
+        }
+    }
+    pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[]) {
+    pthread_t w_th, r_th[r_num];
+    unsigned int stamp = 0;
+    int passes = 0;
+    bool passed = true;
+
+    printf("optimistic read test:\n");
+    rwl_init(&rwlock);
+
+    do{
+        rwl_oread_begin(&rwlock, &stamp);
+        passes++;
+    }while(rwl_oread_retry(&rwlock, &stamp));
+    if(passes != 1 || stamp == RWL_OREAD_LOCKED){
+        printf("optimistic read is retried with no writer around!\n");
+        passed = false;
+    }
+
+    stamp = 0;
+    passes = 0;
+    do{
+        rwl_oread_begin(&rwlock, &stamp);
+        if(passes++ == 0){
+            pthread_create(&w_th, NULL, &writer, NULL);
+            pthread_join(w_th, NULL);
+        }else if(rwl_trywlock(&rwlock, 0) != EBUSY){
+            printf("retried optimistic read does not hold a read lock!\n");
+            passed = false;
+        }
+    }while(rwl_oread_retry(&rwlock, &stamp));
+    if(passes != 2){
+        printf("optimistic read is not retried after a writer!\n");
+        passed = false;
+    }
+
+    rwl_wlock(&rwlock, 2);
+    r_state = 0;
+    pthread_create(&r_th[0], NULL, &reader, NULL);
+    while(r_state == 0){
+        sched_yield();
+    }
+    for(int i = 0; i < 100; i++){
+        sched_yield();
+    }
+    if(r_state != 1){
+        printf("optimistic read completes while a writer is inside!\n");
+        passed = false;
+    }
+    rwl_wunlock(&rwlock, 2);
+    pthread_join(r_th[0], NULL);
+
+    stop = 0;
+    pthread_create(&w_th, NULL, &writer_loop, NULL);
+    for(int i = 0; i < r_num; i++){
+        pthread_create(&r_th[i], NULL, &reader_loop, NULL);
+    }
+    for(int i = 0; i < r_num; i++){
+        pthread_join(r_th[i], NULL);
+    }
+    stop = 1;
+    pthread_join(w_th, NULL);
+    if(torn == true){
+        printf("optimistic reader sees a torn pair!\n");
+        passed = false;
+    }
+    rwl_destroy(&rwlock);
+
+    if(passed == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+#define gettid() syscall(SYS_gettid)
+
+#include "rwlock.h"
+#include "test_common.h"
+
+typedef enum{true, false} bool;
+
+/*
+statistics tests seq:
+A lock without RWL_STATS has no statistics
+Main takes and releases read twice, then write (priority 1) for HOLD_MS:
+    two uncontended reads, one uncontended write held at least HOLD_MS
+Main takes write (priority 0)
+Writer 0 (priority 2), Upgrader 0 and Upgrader 1 arrive and wait
+Main releases the write after HOLD_MS: Writer 0 waited at least HOLD_MS;
+    both upgraders are woken, one of them finds the other got in first
+*/
+
+#define t_num 3
+#define HOLD_MS 20
+#define MS 1000000ull
+
+rwl rwlock;
+int t_prior[t_num] = {2, -1, -1};
+volatile int t_tid[t_num];
+
+void * worker(void* args) {
+    int id = *(int *)args;
+    t_tid[id] = gettid();
+    if(t_prior[id] < 0){
+        rwl_ulock(&rwlock);
+        usleep(HOLD_MS * 1000);
+        rwl_uunlock(&rwlock);
+    }else{
+        rwl_wlock(&rwlock, t_prior[id]);
+        rwl_wunlock(&rwlock, t_prior[id]);
+    }
+    pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[]) {
+    pthread_t th[t_num];
+    int id[t_num];
+    rwl_attr attr;
+    rwl_stats st;
+    bool passed = true;
+
+    printf("statistics test:\n");
+    rwl_init(&rwlock);
+    if(rwl_stats_get(&rwlock, &st) != EINVAL){
+        printf("a lock without RWL_STATS has statistics!\n");
+        passed = false;
+    }
+    rwl_destroy(&rwlock);
+
+    rwl_attr_init(&attr);
+    attr.flags = RWL_STATS;
+    if(rwl_init_attr(&rwlock, &attr) != 0){
+        printf("failed to initialize the lock!\n");
+        return 0;
+    }
+    for(int i = 0; i < 2; i++){
+        rwl_rlock(&rwlock);
+        rwl_runlock(&rwlock);
+    }
+    rwl_wlock(&rwlock, 1);
+    usleep(HOLD_MS * 1000);
+    rwl_wunlock(&rwlock, 1);
+    if(rwl_stats_get(&rwlock, &st) != 0){
+        printf("a RWL_STATS lock has no statistics!\n");
+        passed = false;
+    }
+    if(st.read.acquired != 2 || st.read.contended != 0 ||
+        st.write[1].acquired != 1 || st.write[1].contended != 0 ||
+        st.write[0].acquired != 0){
+        printf("uncontended acquisitions are miscounted!\n");
+        passed = false;
+    }
+    if(st.write[1].hold_ns < HOLD_MS * MS ||
+        st.write[1].hold_max_ns != st.write[1].hold_ns){
+        printf("write hold time is wrong!\n");
+        passed = false;
+    }
+
+    rwl_wlock(&rwlock, 0);
+    for(int i = 0; i < t_num; i++){
+        id[i] = i;
+        t_tid[i] = 0;
+        if(pthread_create(&th[i], NULL, &worker, &id[i]) != 0){
+            printf("Failed to create threads!\n");
+            return 0;
+        }
+        if(wait_blocked(&t_tid[i]) != 0){
+            printf("thread %d does not wait for the lock!\n", i);
+            passed = false;
+        }
+    }
+    usleep(HOLD_MS * 1000);
+    rwl_wunlock(&rwlock, 0);
+    for(int i = 0; i < t_num; i++){
+        pthread_join(th[i], NULL);
+    }
+    rwl_stats_get(&rwlock, &st);
+    if(st.write[2].acquired != 1 || st.write[2].contended != 1 ||
+        st.write[2].wait_ns < HOLD_MS * MS){
+        printf("contended write is miscounted!\n");
+        passed = false;
+    }
+    if(st.read.acquired != 4 || st.read.contended != 2 ||
+        st.read.hold_max_ns < HOLD_MS * MS){
+        printf("contended reads are miscounted!\n");
+        passed = false;
+    }
+    if(st.read.spurious < 1){
+        printf("wakeup of the second upgrader is not counted!\n");
+        passed = false;
+    }
+    rwl_destroy(&rwlock);
+
+    if(passed == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+
+#include "rwlock.h"
+
+typedef enum{true, false} bool;
+
+/*
+timed lock tests seq, run on a plain, a big-reader and an adaptive lock:
+Main takes write
+Main tries timed read and timed write 100ms out: both time out, no earlier
+Main tries timed read with a bad tv_nsec: invalid
+Main releases the write
+Main tries timed read and timed write on the free lock: both succeed
+Main takes read, Writer 0 (priority 0) waits for write 200ms out
+(plain lock only) Reader 0 blocks behind Writer 0
+Writer 0 times out; Reader 0 gets in while Main still holds its read
+Main releases the read, tries timed write: succeeds
+*/
+
+rwl rwlock;
+volatile int w_result;
+volatile int r_done;
+
+struct timespec deadline(long ms){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000;
+    if(ts.tv_nsec >= 1000000000){
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+/* true if the monotonic clock has reached ts */
+bool passed(const struct timespec *ts){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(now.tv_sec > ts->tv_sec ||
+        (now.tv_sec == ts->tv_sec && now.tv_nsec >= ts->tv_nsec)){
+        return true;
+    }
+    return false;
+}
+
+void * writer(void* args) {
+    struct timespec ts = deadline(200);
+    w_result = rwl_timedwlock(&rwlock, 0, &ts);
+    if(w_result == 0){
+        rwl_wunlock(&rwlock, 0);
+    }
+    pthread_exit(NULL);
+}
+
+void * reader(void* args) {
+    rwl_rlock(&rwlock);
+    r_done = 1;
+    rwl_runlock(&rwlock);
+    pthread_exit(NULL);
+}
+
+bool run_tests(unsigned int flags){
+    rwl_attr attr;
+    pthread_t w_th, r_th;
+    struct timespec ts;
+
+    rwl_attr_init(&attr);
+    attr.flags = flags;
+    if(rwl_init_attr(&rwlock, &attr) != 0){
+        printf("failed to initialize the lock!\n");
+        return false;
+    }
+
+    rwl_wlock(&rwlock, 1);
+    ts = deadline(100);
+    if(rwl_timedrlock(&rwlock, &ts) != ETIMEDOUT || passed(&ts) != true){
+        printf("reader fails to time out on a write-held lock!\n");
+        return false;
+    }
+    ts = deadline(100);
+    if(rwl_timedwlock(&rwlock, 2, &ts) != ETIMEDOUT || passed(&ts) != true){
+        printf("writer fails to time out on a write-held lock!\n");
+        return false;
+    }
+    ts = deadline(100);
+    ts.tv_nsec = 1000000000;
+    if(rwl_timedrlock(&rwlock, &ts) != EINVAL){
+        printf("reader accepts a bad deadline!\n");
+        return false;
+    }
+    rwl_wunlock(&rwlock, 1);
+
+    ts = deadline(100);
+    if(rwl_timedrlock(&rwlock, &ts) != 0){
+        printf("reader fails to acquire a free lock before the deadline!\n");
+        return false;
+    }
+    rwl_runlock(&rwlock);
+    if(rwl_timedwlock(&rwlock, 0, &ts) != 0){
+        printf("writer fails to acquire a free lock before the deadline!\n");
+        return false;
+    }
+    rwl_wunlock(&rwlock, 0);
+
+    // a writer giving up must let in the readers it was holding back
+    rwl_rlock(&rwlock);
+    w_result = -1;
+    r_done = 0;
+    if(pthread_create(&w_th, NULL, &writer, NULL) != 0){
+        printf("Failed to create threads!\n");
+        return false;
+    }
+    if(!(flags & RWL_BIGREADER)){
+        // wait for the writer to queue so the reader blocks behind it
+        while(rwl_tryrlock(&rwlock) == 0){
+            rwl_runlock(&rwlock);
+            sched_yield();
+        }
+        if(pthread_create(&r_th, NULL, &reader, NULL) != 0){
+            printf("Failed to create threads!\n");
+            return false;
+        }
+    }
+    pthread_join(w_th, NULL);
+    if(w_result != ETIMEDOUT){
+        printf("writer fails to time out on a read-held lock!\n");
+        return false;
+    }
+    if(!(flags & RWL_BIGREADER)){
+        pthread_join(r_th, NULL);
+        if(r_done != 1){
+            printf("reader is not woken when the writer ahead gives up!\n");
+            return false;
+        }
+    }
+    rwl_runlock(&rwlock);
+
+    ts = deadline(100);
+    if(rwl_timedwlock(&rwlock, 2, &ts) != 0){
+        printf("writer fails to acquire the lock after a timed out writer!\n");
+        return false;
+    }
+    rwl_wunlock(&rwlock, 2);
+    rwl_destroy(&rwlock);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    printf("timed lock test:\n");
+    if(run_tests(0) == true && run_tests(RWL_BIGREADER) == true &&
+        run_tests(RWL_ADAPTIVE) == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+
+#include "rwlock.h"
+
+typedef enum{true, false} bool;
+
+/*
+trylock tests seq, run on a plain, a big-reader and an adaptive lock:
+Main tries read twice: both succeed
+Main tries write: busy (readers inside)
+Main releases both reads
+Main tries write at priority 1: succeeds
+Main tries read, write at priority 0: both busy
+Main releases the write
+Main takes read, Writer 0 (priority 2) queues behind it
+Main tries read until it is refused: a queued writer keeps new readers out
+Main tries write at priority 0: busy (reader inside)
+Main releases the read, Writer 0 acquires and releases the lock
+Main tries read and write again: both succeed
+*/
+
+rwl rwlock;
+volatile int w_done;
+
+void * writer(void* args) {
+    rwl_wlock(&rwlock, 2);
+    rwl_wunlock(&rwlock, 2);
+    w_done = 1;
+    pthread_exit(NULL);
+}
+
+/* retry a trylock for up to a second, for states another thread sets up */
+bool eventually_busy(void){
+    clock_t before = clock();
+    while((clock() - before) * 1000 / CLOCKS_PER_SEC < 1000){
+        if(rwl_tryrlock(&rwlock) == EBUSY){
+            return true;
+        }
+        rwl_runlock(&rwlock);
+        sched_yield();
+    }
+    return false;
+}
+
+bool run_tests(unsigned int flags){
+    rwl_attr attr;
+    pthread_t w_th;
+
+    rwl_attr_init(&attr);
+    attr.flags = flags;
+    if(rwl_init_attr(&rwlock, &attr) != 0){
+        printf("failed to initialize the lock!\n");
+        return false;
+    }
+
+    if(rwl_tryrlock(&rwlock) != 0 || rwl_tryrlock(&rwlock) != 0){
+        printf("reader fails to try-acquire a free lock!\n");
+        return false;
+    }
+    if(rwl_trywlock(&rwlock, 0) != EBUSY){
+        printf("writer wrongly try-acquires a read-held lock!\n");
+        return false;
+    }
+    rwl_runlock(&rwlock);
+    rwl_runlock(&rwlock);
+
+    if(rwl_trywlock(&rwlock, 1) != 0){
+        printf("writer fails to try-acquire a free lock!\n");
+        return false;
+    }
+    if(rwl_tryrlock(&rwlock) != EBUSY){
+        printf("reader wrongly try-acquires a write-held lock!\n");
+        return false;
+    }
+    if(rwl_trywlock(&rwlock, 0) != EBUSY){
+        printf("writer wrongly try-acquires a write-held lock!\n");
+        return false;
+    }
+    rwl_wunlock(&rwlock, 1);
+
+    rwl_rlock(&rwlock);
+    w_done = 0;
+    if(pthread_create(&w_th, NULL, &writer, NULL) != 0){
+        printf("Failed to create threads!\n");
+        return false;
+    }
+    if(eventually_busy() != true){
+        printf("reader wrongly try-acquires the lock ahead of a waiting writer!\n");
+        return false;
+    }
+    if(rwl_trywlock(&rwlock, 0) != EBUSY){
+        printf("writer wrongly try-acquires a read-held lock!\n");
+        return false;
+    }
+    rwl_runlock(&rwlock);
+    pthread_join(w_th, NULL);
+    if(w_done != 1){
+        printf("writer 0 fails to acquire the lock!\n");
+        return false;
+    }
+
+    if(rwl_tryrlock(&rwlock) != 0){
+        printf("reader fails to try-acquire a free lock!\n");
+        return false;
+    }
+    rwl_runlock(&rwlock);
+    if(rwl_trywlock(&rwlock, 2) != 0){
+        printf("writer fails to try-acquire a free lock!\n");
+        return false;
+    }
+    rwl_wunlock(&rwlock, 2);
+    rwl_destroy(&rwlock);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    printf("trylock test:\n");
+    if(run_tests(0) == true && run_tests(RWL_BIGREADER) == true &&
+        run_tests(RWL_ADAPTIVE) == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}
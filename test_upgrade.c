@@ -0,0 +1,150 @@
+#include <unistd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "rwlock.h"
+
+typedef enum{true, false} bool;
+
+/*
+upgrade tests seq, run on a plain and a big-reader lock:
+Main takes upgradeable read; tries read: succeeds; tries write: busy
+Upgrader 0 asks for upgradeable read and waits until Main releases
+Reader 0 takes read, Main takes upgradeable read and upgrades at priority 1
+Main's upgrade waits until Reader 0 leaves; Main tries read: busy
+Main downgrades to read; tries read: succeeds; tries write: busy
+Main releases the read
+Main takes write, Writer 0 (priority 0) queues behind it
+Main downgrades to read: Writer 0 keeps waiting until Main releases the read
+*/
+
+rwl rwlock;
+volatile int u_done;
+volatile int r_left;
+volatile int w_done;
+
+void * upgrader(void* args) {
+    rwl_ulock(&rwlock);
+    u_done = 1;
+    rwl_uunlock(&rwlock);
+    pthread_exit(NULL);
+}
+
+void * reader(void* args) {
+    rwl_rlock(&rwlock);
+    r_left = 0;
+    usleep(200000);
+    r_left = 1;
+    rwl_runlock(&rwlock);
+    pthread_exit(NULL);
+}
+
+void * writer(void* args) {
+    rwl_wlock(&rwlock, 0);
+    w_done = 1;
+    rwl_wunlock(&rwlock, 0);
+    pthread_exit(NULL);
+}
+
+bool run_tests(unsigned int flags){
+    rwl_attr attr;
+    pthread_t th;
+
+    rwl_attr_init(&attr);
+    attr.flags = flags;
+    if(rwl_init_attr(&rwlock, &attr) != 0){
+        printf("failed to initialize the lock!\n");
+        return false;
+    }
+
+    rwl_ulock(&rwlock);
+    if(rwl_tryrlock(&rwlock) != 0){
+        printf("reader fails to share the lock with an upgradeable reader!\n");
+        return false;
+    }
+    rwl_runlock(&rwlock);
+    if(rwl_trywlock(&rwlock, 0) != EBUSY){
+        printf("writer wrongly try-acquires an upgradeable hold!\n");
+        return false;
+    }
+    u_done = 0;
+    if(pthread_create(&th, NULL, &upgrader, NULL) != 0){
+        printf("Failed to create threads!\n");
+        return false;
+    }
+    usleep(100000);
+    if(u_done != 0){
+        printf("two upgradeable readers hold the lock at once!\n");
+        return false;
+    }
+    rwl_uunlock(&rwlock);
+    pthread_join(th, NULL);
+    if(u_done != 1){
+        printf("upgradeable reader is not let in after the last one leaves!\n");
+        return false;
+    }
+
+    r_left = -1;
+    if(pthread_create(&th, NULL, &reader, NULL) != 0){
+        printf("Failed to create threads!\n");
+        return false;
+    }
+    while(r_left == -1){
+        usleep(1000);
+    }
+    rwl_ulock(&rwlock);
+    rwl_uupgrade(&rwlock, 1);
+    if(r_left != 1){
+        printf("upgrade does not wait for the readers inside!\n");
+        return false;
+    }
+    if(rwl_tryrlock(&rwlock) != EBUSY){
+        printf("reader wrongly try-acquires an upgraded lock!\n");
+        return false;
+    }
+    rwl_wdowngrade(&rwlock, 1);
+    if(rwl_tryrlock(&rwlock) != 0){
+        printf("reader fails to share a downgraded lock!\n");
+        return false;
+    }
+    rwl_runlock(&rwlock);
+    if(rwl_trywlock(&rwlock, 0) != EBUSY){
+        printf("writer wrongly try-acquires a downgraded lock!\n");
+        return false;
+    }
+    rwl_runlock(&rwlock);
+    pthread_join(th, NULL);
+
+    rwl_wlock(&rwlock, 2);
+    w_done = 0;
+    if(pthread_create(&th, NULL, &writer, NULL) != 0){
+        printf("Failed to create threads!\n");
+        return false;
+    }
+    usleep(100000);
+    rwl_wdowngrade(&rwlock, 2);
+    usleep(100000);
+    if(w_done != 0){
+        printf("writer gets in while the downgraded read is held!\n");
+        return false;
+    }
+    rwl_runlock(&rwlock);
+    pthread_join(th, NULL);
+    if(w_done != 1){
+        printf("writer 0 fails to acquire the lock!\n");
+        return false;
+    }
+    rwl_destroy(&rwlock);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    printf("upgrade test:\n");
+    if(run_tests(0) == true && run_tests(RWL_BIGREADER) == true){
+        printf("Test Passed!\n");
+    }else{
+        printf("Test Failed!\n");
+    }
+    return 0;
+}